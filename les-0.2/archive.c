@@ -0,0 +1,131 @@
+/**
+ * archive.c -- Binary sample archive.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "archive.h"
+
+/**
+ * Check an archive header.
+ */
+static int archive_valid(struct archive_hdr_t *hdr) {
+	return !memcmp(hdr->magic, ARCHIVE_MAGIC, 4) && hdr->version == ARCHIVE_VERSION
+		&& hdr->recsize == sizeof(struct archive_rec_t);
+}
+
+/**
+ * Open fname for appending records, creating it if needed. A partial record
+ * left at the end by an interrupted write is removed. Returns the file
+ * descriptor, or -1 if the file cannot be opened or is not an archive.
+ */
+int archive_open(char *fname) {
+	struct archive_hdr_t hdr;
+	struct stat st;
+	off_t len;
+	int fd;
+
+	fd = open(fname, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		if (fd >= 0) close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		memset(&hdr, 0, sizeof(struct archive_hdr_t));
+		memcpy(hdr.magic, ARCHIVE_MAGIC, 4);
+		hdr.version = ARCHIVE_VERSION;
+		hdr.recsize = sizeof(struct archive_rec_t);
+		if (write(fd, &hdr, sizeof(struct archive_hdr_t)) != sizeof(struct archive_hdr_t)) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	}
+
+	if (pread(fd, &hdr, sizeof(struct archive_hdr_t), 0) != sizeof(struct archive_hdr_t) || !archive_valid(&hdr)) {
+		close(fd);
+		return -1;
+	}
+
+	len = st.st_size - sizeof(struct archive_hdr_t);
+	if (len % sizeof(struct archive_rec_t)) {
+		ftruncate(fd, st.st_size - len % sizeof(struct archive_rec_t));
+	}
+	return fd;
+}
+
+/**
+ * Fill in a record.
+ */
+void archive_fill(struct archive_rec_t *rec, struct timeval *rxtime, struct ptp_sample_t *raw, long long delay, double load, int flags) {
+	rec->rxtime = (int64_t)rxtime->tv_sec * 1000000 + rxtime->tv_usec;
+	rec->t1 = raw->t1;
+	rec->t2 = raw->t2;
+	rec->t3 = raw->t3;
+	rec->t4 = raw->t4;
+	rec->delay = delay;
+	rec->load = load;
+	rec->flags = flags;
+	rec->reserved = 0;
+}
+
+/**
+ * Map an archive read-only and return its records, setting nrecs to their
+ * number, or NULL if it cannot be mapped or is not an archive.
+ */
+struct archive_rec_t *archive_map(char *fname, size_t *nrecs) {
+	struct archive_hdr_t *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	*nrecs = 0;
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		return NULL;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct archive_hdr_t)) {
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		return NULL;
+	}
+
+	hdr = (struct archive_hdr_t*)map;
+	if (!archive_valid(hdr)) {
+		munmap(map, st.st_size);
+		return NULL;
+	}
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	*nrecs = (st.st_size - sizeof(struct archive_hdr_t)) / sizeof(struct archive_rec_t);
+	return (struct archive_rec_t*)(hdr + 1);
+}
+
+/**
+ * Unmap the records returned by archive_map().
+ */
+void archive_unmap(struct archive_rec_t *recs, size_t nrecs) {
+	if (recs) {
+		munmap((char*)recs - sizeof(struct archive_hdr_t), sizeof(struct archive_hdr_t) + nrecs * sizeof(struct archive_rec_t));
+	}
+}
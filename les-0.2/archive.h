@@ -0,0 +1,100 @@
+/**
+ * archive.h -- Binary sample archive. An archive is a header followed by
+ * fixed size records, one per line read from the PTP device, with the raw
+ * timestamps next to the delay and load computed from them. Records are only
+ * ever appended and are laid out so that readers can map the file and use
+ * it as an array.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+#include "ptpdevice.h"
+
+#define ARCHIVE_MAGIC		"LESA"
+#define ARCHIVE_VERSION		1
+
+/* record flags */
+#define ARCHIVE_DELAY_RESP	1 /* new T3/T4 (otherwise a SYNC) */
+#define ARCHIVE_IGNORED		2 /* not used for load estimation */
+
+/**
+ * File header. All fields are in host (little-endian) byte order.
+ */
+struct archive_hdr_t {
+	char magic[4];
+	uint16_t version;
+	/* sizeof(struct archive_rec_t) */
+	uint16_t recsize;
+	uint32_t reserved[2];
+};
+
+/**
+ * A line read from the PTP device.
+ */
+struct archive_rec_t {
+	/* local time the line was read (usec since the epoch) */
+	int64_t rxtime;
+	/* PTP timestamps (nsec) */
+	int64_t t1;
+	int64_t t2;
+	int64_t t3;
+	int64_t t4;
+	/* 1-way delay (nsec) */
+	int64_t delay;
+	/* load estimate after the sample */
+	double load;
+	uint32_t flags;
+	uint32_t reserved;
+};
+
+/**
+ * Open fname for appending records, creating it if needed. A partial record
+ * left at the end by an interrupted write is removed. Returns the file
+ * descriptor, or -1 if the file cannot be opened or is not an archive.
+ */
+int archive_open(char *fname);
+
+/**
+ * Fill in a record.
+ */
+void archive_fill(struct archive_rec_t *rec, struct timeval *rxtime, struct ptp_sample_t *raw, long long delay, double load, int flags);
+
+/**
+ * Map an archive read-only and return its records, setting nrecs to their
+ * number, or NULL if it cannot be mapped or is not an archive.
+ */
+struct archive_rec_t *archive_map(char *fname, size_t *nrecs);
+
+/**
+ * Unmap the records returned by archive_map().
+ */
+void archive_unmap(struct archive_rec_t *recs, size_t nrecs);
+
+#endif
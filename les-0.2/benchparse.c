@@ -0,0 +1,156 @@
+/**
+ * benchparse.c -- Microbenchmark of the parsing of SecureSync lines: the
+ * single-pass ptp_parse_line() against the sscanf() based code it replaced
+ * (extract_sample_delay() and is_sync() of les 0.2). Both run the device
+ * thread path with skipsync on over the lines of a trace, repeatedly, and
+ * must agree on the delays of the lines accepted.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "ptpdevice.h"
+#include "replay.h"
+
+#include <time.h>
+
+/* lines of the trace used at most */
+#define BENCH_MAXLINES	100000
+
+/**
+ * Parse a line read from the ptp device and calculate the 1-way delay included
+ * in the sample (les 0.2).
+ */
+static long long extract_sample_delay(char *line) {
+	int x;
+	long long t1, t2, t3, t4;
+	sscanf(line, "%d %d:%d:%d.%d %Ld %Ld %Ld %Ld", &x, &x, &x, &x, &x, &t1, &t2, &t3, &t4);
+	return (t2 - t1 + t4 - t3)/2;
+}
+
+/**
+ * If the T3 and T4 values are the same across two samples, then it's a SYNC
+ * (les 0.2).
+ */
+static int is_sync(char *last_sample, char *sample) {
+	int x;
+	long long y, t3old, t4old, t3, t4;
+	sscanf(last_sample, "%d %d:%d:%d.%d %Ld %Ld %Ld %Ld", &x, &x, &x, &x, &x, &y, &y, &t3old, &t4old);
+	sscanf(sample, "%d %d:%d:%d.%d %Ld %Ld %Ld %Ld", &x, &x, &x, &x, &x, &y, &y, &t3, &t4);
+
+	if (t3 == t3old && t4 == t4old) return 1;
+	return 0;
+}
+
+/**
+ * One pass of the old code over the lines. Returns the sum of the delays.
+ */
+static long long run_sscanf(char **lines, int n, int *nsamples) {
+	long long sum = 0;
+	int i;
+
+	for (i = 1; i < n; i++) {
+		if (is_sync(lines[i - 1], lines[i])) continue;
+		sum += extract_sample_delay(lines[i]);
+		(*nsamples)++;
+	}
+	return sum;
+}
+
+/**
+ * One pass of the current code over the lines. Returns the sum of the
+ * delays.
+ */
+static long long run_parser(char **lines, int n, int *nsamples) {
+	struct ptp_sample_t cur, last;
+	long long sum = 0;
+	int have_last = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (ptp_parse_line(lines[i], &cur) != PTP_LINE_OK) continue;
+		if (have_last && !ptp_is_sync(&last, &cur)) {
+			sum += ptp_sample_delay(&cur);
+			(*nsamples)++;
+		}
+		last = cur;
+		have_last = 1;
+	}
+	return sum;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	struct replay_t trace;
+	char **lines;
+	char line[PTP_LINE_LEN + 2];
+	long long sum_old = 0, sum_new = 0;
+	double t_old, t_new;
+	int nold = 0, nnew = 0;
+	int passes = 2000;
+	int n = 0;
+	int i;
+
+	if (argc < 2 || argc > 3) {
+		fprintf(stderr, "Usage: benchparse trace [passes]\n"
+			"  trace: recorded SecureSync lines (e.g., serialemu/data-long.log)\n"
+			"  passes: times the trace is parsed by each variant (default: %d)\n", passes);
+		return 1;
+	}
+	if (argc == 3) passes = atoi(argv[2]);
+	if (passes < 1) passes = 1;
+	if (replay_open(&trace, argv[1]) < 0) {
+		fprintf(stderr, "Error: could not read %s\n", argv[1]);
+		return 1;
+	}
+	lines = (char**)malloc(BENCH_MAXLINES * sizeof(char*));
+	while (lines && n < BENCH_MAXLINES && replay_next(&trace, line, sizeof(line)) >= 0) {
+		if (!(lines[n] = strdup(line))) break;
+		n++;
+	}
+	replay_close(&trace);
+	if (n < 2) {
+		fprintf(stderr, "Error: not enough lines in %s\n", argv[1]);
+		return 1;
+	}
+
+	t_old = now();
+	for (i = 0; i < passes; i++) {
+		sum_old += run_sscanf(lines, n, &nold);
+	}
+	t_old = now() - t_old;
+
+	t_new = now();
+	for (i = 0; i < passes; i++) {
+		sum_new += run_parser(lines, n, &nnew);
+	}
+	t_new = now() - t_new;
+
+	printf("%d lines x %d passes\n", n, passes);
+	printf("sscanf:          %8.3f usec/line (%d samples, delay sum %lld)\n", t_old * 1e6 / ((double)n * passes), nold / passes, sum_old / passes);
+	printf("ptp_parse_line:  %8.3f usec/line (%d samples, delay sum %lld)\n", t_new * 1e6 / ((double)n * passes), nnew / passes, sum_new / passes);
+	printf("speed-up:        %8.1f\n", t_old / t_new);
+	if (nold != nnew || sum_old != sum_new) {
+		printf("note: the results differ; the old code also accepts malformed lines\n");
+	}
+	return 0;
+}
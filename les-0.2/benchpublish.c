@@ -0,0 +1,208 @@
+/**
+ * benchpublish.c -- Microbenchmark of the publication of the load
+ * statistics to request handlers: readers copying the snapshot under the
+ * seqlock (get_load_info()) against under a mutex, as in les 0.2, while a
+ * writer keeps updating it. Reader throughput is measured for 1 up to the
+ * given number of reader threads, along with the updates the writer got
+ * through and the reads found inconsistent (there should be none).
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "protocol.h"
+#include "seqlock.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#define BENCH_MAXREADERS	64
+#define BENCH_SEQLOCK		0
+#define BENCH_MUTEX			1
+
+/**
+ * The published statistics, as in struct les_path_t.
+ */
+struct shared_t {
+	struct seqlock_t seqlock;
+	pthread_mutex_t mutex;
+	struct load_info_t snapshot;
+	int mode;
+	/* writer pause between updates (usec) */
+	int interval;
+	volatile int stop;
+	unsigned long long updates;
+};
+
+/**
+ * Counters of a reader, on a cache line of its own.
+ */
+struct reader_t {
+	struct shared_t *shared;
+	unsigned long long reads;
+	unsigned long long torn;
+} __attribute__((aligned(64)));
+
+/**
+ * Writer thread: publish a new snapshot, whose fields all hold the update
+ * number, then pause.
+ */
+static void *writer(void *arg) {
+	struct shared_t *sh = (struct shared_t*)arg;
+	struct load_info_t stats;
+	struct timespec pause;
+	unsigned int seq = 0;
+
+	pause.tv_sec = sh->interval / 1000000;
+	pause.tv_nsec = (sh->interval % 1000000) * 1000;
+	memset(&stats, 0, sizeof(struct load_info_t));
+	while (!sh->stop) {
+		seq++;
+		stats.seq = seq;
+		stats.nsamples = seq;
+		stats.timestamp = seq;
+		stats.max = seq;
+		stats.load_type = seq;
+		if (sh->mode == BENCH_SEQLOCK) {
+			seqlock_write_begin(&sh->seqlock);
+			memcpy(&sh->snapshot, &stats, sizeof(struct load_info_t));
+			seqlock_write_end(&sh->seqlock);
+		}
+		else {
+			pthread_mutex_lock(&sh->mutex);
+			memcpy(&sh->snapshot, &stats, sizeof(struct load_info_t));
+			pthread_mutex_unlock(&sh->mutex);
+		}
+		if (sh->interval) nanosleep(&pause, NULL);
+	}
+	sh->updates = seq;
+	return NULL;
+}
+
+/**
+ * Reader thread: copy the snapshot until stopped, as a request handler does.
+ */
+static void *reader(void *arg) {
+	struct reader_t *r = (struct reader_t*)arg;
+	struct shared_t *sh = r->shared;
+	struct load_info_t linfo;
+	unsigned int seq;
+
+	while (!sh->stop) {
+		if (sh->mode == BENCH_SEQLOCK) {
+			do {
+				seq = seqlock_read_begin(&sh->seqlock);
+				memcpy(&linfo, &sh->snapshot, sizeof(struct load_info_t));
+			} while (seqlock_read_retry(&sh->seqlock, seq));
+		}
+		else {
+			pthread_mutex_lock(&sh->mutex);
+			memcpy(&linfo, &sh->snapshot, sizeof(struct load_info_t));
+			pthread_mutex_unlock(&sh->mutex);
+		}
+		if (linfo.nsamples != (int)linfo.seq || linfo.max != linfo.timestamp || linfo.load_type != (double)linfo.seq) {
+			r->torn++;
+		}
+		r->reads++;
+	}
+	return NULL;
+}
+
+/**
+ * Run nreaders readers and the writer for duration msec. Returns the reads
+ * per second.
+ */
+static double run(int mode, int nreaders, int interval, int duration, unsigned long long *updates, unsigned long long *torn) {
+	static struct reader_t readers[BENCH_MAXREADERS];
+	pthread_t threads[BENCH_MAXREADERS];
+	pthread_t wthread;
+	struct shared_t sh;
+	struct timespec start, end, wait;
+	unsigned long long reads = 0;
+	double secs;
+	int i;
+
+	memset(&sh, 0, sizeof(struct shared_t));
+	pthread_mutex_init(&sh.mutex, NULL);
+	sh.mode = mode;
+	sh.interval = interval;
+	memset(readers, 0, sizeof(readers));
+
+	pthread_create(&wthread, NULL, writer, &sh);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nreaders; i++) {
+		readers[i].shared = &sh;
+		pthread_create(&threads[i], NULL, reader, &readers[i]);
+	}
+	wait.tv_sec = duration / 1000;
+	wait.tv_nsec = (duration % 1000) * 1000000L;
+	nanosleep(&wait, NULL);
+	sh.stop = 1;
+	for (i = 0; i < nreaders; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pthread_join(wthread, NULL);
+	pthread_mutex_destroy(&sh.mutex);
+
+	*torn = 0;
+	for (i = 0; i < nreaders; i++) {
+		reads += readers[i].reads;
+		*torn += readers[i].torn;
+	}
+	*updates = sh.updates;
+	secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return reads / secs;
+}
+
+int main(int argc, char **argv) {
+	static const char *modes[2] = {"seqlock", "mutex"};
+	unsigned long long updates, torn;
+	double rate;
+	int maxreaders = sysconf(_SC_NPROCESSORS_ONLN);
+	int interval = 100;
+	int duration = 1000;
+	int opt;
+	int n, mode;
+
+	while ((opt = getopt(argc, argv, "r:i:t:")) != -1) {
+		switch (opt) {
+			case 'r': maxreaders = atoi(optarg); break;
+			case 'i': interval = atoi(optarg); break;
+			case 't': duration = atoi(optarg); break;
+			default:
+				fprintf(stderr, "Usage: benchpublish [-r readers] [-i interval] [-t duration]\n"
+					"  -r readers: max reader threads (default: one per core)\n"
+					"  -i interval: writer pause between updates (usec, default: 100, 0: none)\n"
+					"  -t duration: time per run (msec, default: 1000)\n");
+				return 1;
+		}
+	}
+	if (maxreaders < 1) maxreaders = 1;
+	if (maxreaders > BENCH_MAXREADERS) maxreaders = BENCH_MAXREADERS;
+	if (interval < 0) interval = 0;
+	if (duration < 1) duration = 1;
+
+	printf("%-8s %-8s %14s %14s %10s %6s\n", "readers", "mode", "reads/sec", "per reader", "updates", "torn");
+	/* 1, 2, 4, ... readers, and maxreaders */
+	for (n = 1; n <= maxreaders; n = (n < maxreaders && n * 2 > maxreaders) ? maxreaders : n * 2) {
+		for (mode = BENCH_SEQLOCK; mode <= BENCH_MUTEX; mode++) {
+			rate = run(mode, n, interval, duration, &updates, &torn);
+			printf("%-8d %-8s %14.0f %14.0f %10llu %6llu\n", n, modes[mode], rate, rate / n, updates, torn);
+		}
+	}
+	return 0;
+}
@@ -57,6 +57,10 @@ int parse_line(char *line, char *key, char *value) {
 		if ( isspace(line[j]) ) {
 			break;
 		}
+		/* key and value buffers hold CONF_MAXLEN characters */
+		if (k == CONF_MAXLEN) {
+			return -1;
+		}
 		key[k] = line[j];
 		k++;
 	}
@@ -72,7 +76,16 @@ int parse_line(char *line, char *key, char *value) {
 		return 1;
 	}
 
-	/* the rest of it is the value */
+	/* trailing whitespace does not count against the value length */
+	while (len > j && isspace(line[len - 1])) {
+		len--;
+	}
+
+	/* the rest of it is the value; refuse to cut it short, as a truncated
+	   value (e.g., a fit function) may still parse, as something else */
+	if (len - j > CONF_MAXLEN) {
+		return -1;
+	}
 	strncpy(value, line + j, len - j);
 
 	/* remove trailing whitespace from value (replace them with \0) */
@@ -87,12 +100,18 @@ int parse_line(char *line, char *key, char *value) {
 	return 2;
 }
 
-int parse_conffile(char *fname, char **confoptions, char **confvalues, int optlen) {
+/**
+ * Read the keys of a section (section.key), or the keys outside any section
+ * if section is NULL. Returns as parse_conffile().
+ */
+int parse_conffile_section(char *fname, char *section, char **confoptions, char **confvalues, int optlen) {
 	FILE *fp;
 	char *line;
 	char key[80];
 	char value[80];
+	char *name;
 	size_t linelen;
+	int seclen = section ? strlen(section) : 0;
 	int i;
 	int ret;
 
@@ -116,8 +135,22 @@ int parse_conffile(char *fname, char **confoptions, char **confvalues, int optle
 		memset(value, 0, 80);
 
 		ret = parse_line(line, key, value);
+		if (ret < 0) {
+			/* key or value too long */
+			if (line) free(line);
+			fclose(fp);
+			return -4;
+		}
 
-		/* if it's a comment, ignore line */
+		/* if it's a comment or belongs to another section, ignore line */
+		name = key;
+		if (section) {
+			if (strncasecmp(key, section, seclen) || key[seclen] != '.') ret = 0;
+			name = key + seclen + 1;
+		}
+		else if (strchr(key, '.')) {
+			ret = 0;
+		}
 		if (!ret) {
 			if (line) free(line);
 			line = NULL;
@@ -125,7 +158,7 @@ int parse_conffile(char *fname, char **confoptions, char **confvalues, int optle
 		}
 		
 		for (i = 0; i < optlen; i++) {
-			if (!strcasecmp(confoptions[i], key)) {
+			if (!strcasecmp(confoptions[i], name)) {
 				if (*confvalues[i]) {
 					/* redefinition of a key */
 					if (line) free(line);
@@ -152,3 +185,11 @@ int parse_conffile(char *fname, char **confoptions, char **confvalues, int optle
 	return 0;
 }
 
+/**
+ * Read the keys outside any section. Returns 0 on success, -1 if the file
+ * cannot be opened, -2 on an invalid key, -3 on a duplicate key, or -4 if a
+ * key or value is longer than CONF_MAXLEN characters.
+ */
+int parse_conffile(char *fname, char **confoptions, char **confvalues, int optlen) {
+	return parse_conffile_section(fname, NULL, confoptions, confvalues, optlen);
+}
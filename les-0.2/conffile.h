@@ -7,7 +7,8 @@
  * key2 value2
  * ....
  *
- * Keys are case-insensitive.
+ * Keys are case-insensitive. Keys of the form section.key belong to a named
+ * section and are only read by parse_conffile_section().
  *
  * Copyright (C) 2011 Pantelis A. Frangoudis <pfrag@aueb.gr>
  * 
@@ -35,7 +36,26 @@
 #include <unistd.h>
 #include <ctype.h>
 
+/* max length of keys and values (their buffers hold CONF_MAXLEN + 1 bytes) */
+#define CONF_MAXLEN	79
+
+/**
+ * Split a configuration line into key and value. Returns 0 for comments and
+ * empty lines, 1 for a key without value, 2 for a key and value, or -1 if
+ * the key or value is longer than CONF_MAXLEN characters.
+ */
 int parse_line(char *line, char *key, char *value);
+
+/**
+ * Read the keys outside any section. Returns 0 on success, -1 if the file
+ * cannot be opened, -2 on an invalid key, -3 on a duplicate key, or -4 if a
+ * key or value is longer than CONF_MAXLEN characters.
+ */
 int parse_conffile(char *fname, char **confoptions, char **confvalues, int optlen);
+/**
+ * Read the keys of a section (section.key), or the keys outside any section
+ * if section is NULL. Returns as parse_conffile().
+ */
+int parse_conffile_section(char *fname, char *section, char **confoptions, char **confvalues, int optlen);
 
 #endif
@@ -0,0 +1,53 @@
+/**
+ * estimator.c -- Load estimation algorithm.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "estimator.h"
+
+/**
+ * Add a delay sample to the window and return the load to which the window
+ * average maps: 0 below Dlow, else the fit function (table if it has points)
+ * capped to 1. Sets *fit_error if the fit function has no finite result.
+ */
+double estimator_instant(struct window_t *window, long long sample, double Dlow, struct fitfunc_t *fitcode,
+	struct fittable_t *table, int *fit_error) {
+	double avg;
+	double l;
+
+	/* Add sample to window and slide it */
+	window_slide(window, sample);
+
+	/* Calculate window average */
+	avg = window_average(window);
+
+	/* If delay is below a threshold, consider current load as 0 */
+	if (avg < Dlow) {
+		return 0.0;
+	}
+
+	/* Otherwise, use curve. If curve value > 1.0, consider curr load as 1*/
+	if (table->npoints) {
+		return fittable_lookup(table, avg);
+	}
+	l = map_to_load(fitcode, avg);
+	if (!isfinite(l)) {
+		*fit_error = 1;
+	}
+	return fmin(l, 1.0);
+}
@@ -0,0 +1,48 @@
+/**
+ * estimator.h -- Load estimation algorithm: the delay window average is
+ * mapped to a load through the fit function (or its interpolation table) and
+ * smoothed with an exponentially weighted moving average. Shared by the
+ * server and the parameter sweep (leseval), so both run the same code.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _ESTIMATOR_H_
+#define _ESTIMATOR_H_
+
+#include <math.h>
+
+#include "window.h"
+#include "funceval.h"
+#include "fittable.h"
+
+/**
+ * Add a delay sample to the window and return the load to which the window
+ * average maps: 0 below Dlow, else the fit function (table if it has points)
+ * capped to 1. Sets *fit_error if the fit function has no finite result.
+ */
+double estimator_instant(struct window_t *window, long long sample, double Dlow, struct fitfunc_t *fitcode,
+	struct fittable_t *table, int *fit_error);
+
+/**
+ * Smooth the load estimate with the instant load l (w: smoothing factor).
+ */
+static inline double estimator_smooth(double load, double l, double w) {
+	return w*load + (1 - w)*l;
+}
+
+#endif
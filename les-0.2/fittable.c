@@ -0,0 +1,173 @@
+/**
+ * fittable.c -- Precomputed piecewise linear approximation of the fit
+ * function.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "fittable.h"
+
+/**
+ * Exact (clamped) value of the curve.
+ */
+static double fittable_exact(struct fitfunc_t *func, double x) {
+	return fmin(map_to_load(func, x), 1.0);
+}
+
+/**
+ * Max error of the linear interpolation between points i and i+1.
+ */
+static double fittable_segment_error(struct fittable_t *table, int i) {
+	double err = 0.0;
+	double x, y, e;
+	int k;
+
+	for (k = 1; k < FITTABLE_PROBES; k++) {
+		x = table->x[i] + (table->x[i + 1] - table->x[i]) * k / FITTABLE_PROBES;
+		y = table->y[i] + (table->y[i + 1] - table->y[i]) * k / FITTABLE_PROBES;
+		e = fabs(fittable_exact(table->func, x) - y);
+		if (!(e <= err)) err = e; /* NaN propagates */
+	}
+	return err;
+}
+
+/**
+ * Find the delay where the curve reaches 1.0, starting from lo.
+ */
+static double fittable_upper_bound(struct fitfunc_t *func, double lo) {
+	double prev = lo;
+	double x = 2 * lo;
+	double mid;
+	int i;
+
+	while (x < FITTABLE_MAXDELAY && fittable_exact(func, x) < 1.0) {
+		prev = x;
+		x *= 2;
+	}
+	if (x >= FITTABLE_MAXDELAY) {
+		return FITTABLE_MAXDELAY;
+	}
+
+	/* bisect (prev, x] */
+	for (i = 0; i < 64; i++) {
+		mid = (prev + x) / 2;
+		if (fittable_exact(func, mid) < 1.0) prev = mid;
+		else x = mid;
+	}
+	return x;
+}
+
+/**
+ * Build a table of at most size points for func over [lo, hi], where hi
+ * is the delay at which func reaches 1.0 (or FITTABLE_MAXDELAY). Segments
+ * are split until the error, estimated at FITTABLE_PROBES points per
+ * segment, is at most maxerr. Returns 0 on success, -1 if no table can be
+ * built, or -2 if size points are not enough; the table is then left empty,
+ * so that func is evaluated directly, with maxerr set to the error reached.
+ */
+int fittable_build(struct fittable_t *table, struct fitfunc_t *func, double lo, int size, double maxerr) {
+	double *err;
+	double worst;
+	int i, k;
+
+	memset(table, 0, sizeof(struct fittable_t));
+	table->func = func;
+
+	if (size < 2 || lo <= 0 || !(fittable_exact(func, lo) < 1.0)) {
+		return -1;
+	}
+
+	table->x = (double*)malloc(size * sizeof(double));
+	table->y = (double*)malloc(size * sizeof(double));
+	err = (double*)malloc(size * sizeof(double));
+
+	table->npoints = 2;
+	table->x[0] = lo;
+	table->x[1] = fittable_upper_bound(func, lo);
+	table->y[0] = fittable_exact(func, table->x[0]);
+	table->y[1] = fittable_exact(func, table->x[1]);
+	err[0] = fittable_segment_error(table, 0);
+
+	do {
+		/* find the worst segment */
+		k = 0;
+		for (i = 1; i < table->npoints - 1; i++) {
+			if (!(err[i] <= err[k])) k = i;
+		}
+		worst = err[k];
+		if (worst <= maxerr || table->npoints == size) break;
+
+		/* split it in half */
+		memmove(&table->x[k + 2], &table->x[k + 1], (table->npoints - k - 1) * sizeof(double));
+		memmove(&table->y[k + 2], &table->y[k + 1], (table->npoints - k - 1) * sizeof(double));
+		memmove(&err[k + 2], &err[k + 1], (table->npoints - k - 2) * sizeof(double));
+		table->npoints++;
+		table->x[k + 1] = (table->x[k] + table->x[k + 2]) / 2;
+		table->y[k + 1] = fittable_exact(func, table->x[k + 1]);
+		err[k] = fittable_segment_error(table, k);
+		err[k + 1] = fittable_segment_error(table, k + 1);
+	} while (1);
+
+	free(err);
+
+	if (isnan(worst)) {
+		/* function not defined somewhere in the range */
+		fittable_free(table);
+		return -1;
+	}
+	if (worst > maxerr) {
+		/* table full */
+		fittable_free(table);
+		table->maxerr = worst;
+		return -2;
+	}
+	table->maxerr = worst;
+	return 0;
+}
+
+/**
+ * Return min(func(x), 1.0) using the table, or the fit function itself if
+ * x lies outside the table.
+ */
+double fittable_lookup(struct fittable_t *table, double x) {
+	int lo = 0;
+	int hi = table->npoints - 1;
+	int mid;
+
+	if (x < table->x[lo] || x > table->x[hi]) {
+		return fittable_exact(table->func, x);
+	}
+
+	while (hi - lo > 1) {
+		mid = (lo + hi) / 2;
+		if (table->x[mid] <= x) lo = mid;
+		else hi = mid;
+	}
+
+	return table->y[lo] + (table->y[hi] - table->y[lo]) * (x - table->x[lo]) / (table->x[hi] - table->x[lo]);
+}
+
+/**
+ * Free table memory.
+ */
+void fittable_free(struct fittable_t *table) {
+	if (table->x) free(table->x);
+	if (table->y) free(table->y);
+	table->x = NULL;
+	table->y = NULL;
+	table->npoints = 0;
+}
@@ -0,0 +1,76 @@
+/**
+ * fittable.h -- Precomputed piecewise linear approximation of the fit
+ * function. The curve is sampled between the low load threshold and the
+ * delay where it saturates at 1.0, placing more points where it bends most,
+ * so that a lookup costs a binary search instead of evaluating the function.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _FITTABLE_H_
+#define _FITTABLE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "funceval.h"
+
+/* the table never extends beyond this delay (ns) */
+#define FITTABLE_MAXDELAY	1e10
+
+/* points per segment where the approximation error is measured; the error
+ * between them may be slightly larger */
+#define FITTABLE_PROBES		16
+
+/**
+ * Interpolation table. Points are sorted by delay; values are the fit
+ * function clamped to 1.0, as used by the load estimation algorithm.
+ */
+struct fittable_t {
+	int npoints;
+	double *x;
+	double *y;
+	/* max absolute error against the exact function, as estimated */
+	double maxerr;
+	/* fit function, evaluated directly outside the table range */
+	struct fitfunc_t *func;
+};
+
+/**
+ * Build a table of at most size points for func over [lo, hi], where hi
+ * is the delay at which func reaches 1.0 (or FITTABLE_MAXDELAY). Segments
+ * are split until the error, estimated at FITTABLE_PROBES points per
+ * segment, is at most maxerr. Returns 0 on success, -1 if no table can be
+ * built, or -2 if size points are not enough; the table is then left empty,
+ * so that func is evaluated directly, with maxerr set to the error reached.
+ */
+int fittable_build(struct fittable_t *table, struct fitfunc_t *func, double lo, int size, double maxerr);
+
+/**
+ * Return min(func(x), 1.0) using the table, or the fit function itself if
+ * x lies outside the table.
+ */
+double fittable_lookup(struct fittable_t *table, double x);
+
+/**
+ * Free table memory.
+ */
+void fittable_free(struct fittable_t *table);
+
+#endif
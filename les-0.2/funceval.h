@@ -0,0 +1,76 @@
+/**
+ * funceval.h -- Compiled representation of the load vs. delay fit function.
+ * The function string read from the configuration file is parsed once into
+ * an expression DAG (constants folded, common subexpressions shared), which
+ * is then evaluated directly for each delay value.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _FUNCEVAL_H_
+#define _FUNCEVAL_H_
+
+/* max number of nodes of a compiled function */
+#define FIT_MAXNODES	128
+
+/* node operations */
+#define FIT_CONST		1
+#define FIT_VAR			2
+#define FIT_ADD			3
+#define FIT_SUB			4
+#define FIT_MUL			5
+#define FIT_DIV			6
+#define FIT_POW			7
+#define FIT_POWI		8 /* power with a small integer exponent */
+#define FIT_EXP			9 /* e^x */
+#define FIT_NEG			10
+#define FIT_LOG			11
+#define FIT_LN			12
+
+/**
+ * Expression node. Operands are indices of nodes that precede this one, so
+ * evaluating nodes in array order always finds operands already computed.
+ */
+struct fitnode_t {
+	int op;
+	int left;
+	int right;
+	double value; /* constant value (FIT_CONST) or exponent (FIT_POWI) */
+};
+
+/**
+ * Compiled fit function.
+ */
+struct fitfunc_t {
+	int nnodes;
+	struct fitnode_t nodes[FIT_MAXNODES];
+};
+
+/**
+ * Parses the expression of load as a function of delay into func. Function is
+ * supposed to be the string read from the configuration file, e.g.,
+ * e^-(1.08X) +5*e^(2*X). The name of the variable is *strictly* X.
+ * Returns 0 on success or -1 if the expression is not valid.
+ */
+int compile_fitfunc(char *function, struct fitfunc_t *func);
+
+/**
+ * Evaluates a compiled fit function for the given delay value.
+ */
+double map_to_load(struct fitfunc_t *func, double delay);
+
+#endif
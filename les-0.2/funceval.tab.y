@@ -3,93 +3,308 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "funceval.h"
 #define YYSTYPE double
+/* the parser reads tokens through fitfunc_lex(), which wraps the scanner */
+#define yylex fitfunc_lex
+int fitfunc_lex();
+void yyerror(struct fitfunc_t *ff, const char *s);
+static void fit_push_leaf(struct fitfunc_t *ff, int op, double value);
+static void fit_push_unary(struct fitfunc_t *ff, int op);
+static void fit_push_binary(struct fitfunc_t *ff, int op);
 %}
 
+%code requires {
+#include "funceval.h"
+}
+
 %token NUMBER
 %token PLUS MINUS TIMES DIVIDE POWER
 %token LEFT RIGHT
 %token LOG
 %token LN
 %token END
+%token VAR
 
 %left PLUS MINUS
 %left TIMES DIVIDE
 %left NEG
 %right POWER
 
-%parse-param {double *val}
+%parse-param {struct fitfunc_t *ff}
 %start Input
 %%
 
 Input:
-    
+
      | Input Line
 ;
 
 Line:
      END
-     | Expression END { *val = $1; }
+     | Expression END
 ;
 
 Expression:
-     NUMBER { $$=$1; }
-| Expression PLUS Expression { $$=$1+$3; }
-| Expression MINUS Expression { $$=$1-$3; }
-| Expression TIMES Expression { $$=$1*$3; }
-| Expression DIVIDE Expression { $$=$1/$3; }
-| MINUS Expression %prec NEG { $$=-$2; }
-| Expression POWER Expression { $$=pow($1,$3); }
-| LEFT Expression RIGHT { $$=$2; }
-| LOG LEFT Expression RIGHT { $$=log10($3); }
-| LN LEFT Expression RIGHT { $$=log($3); }
+     NUMBER { fit_push_leaf(ff, FIT_CONST, $1); }
+| VAR { fit_push_leaf(ff, FIT_VAR, 0.0); }
+| Expression PLUS Expression { fit_push_binary(ff, FIT_ADD); }
+| Expression MINUS Expression { fit_push_binary(ff, FIT_SUB); }
+| Expression TIMES Expression { fit_push_binary(ff, FIT_MUL); }
+| Expression DIVIDE Expression { fit_push_binary(ff, FIT_DIV); }
+| MINUS Expression %prec NEG { fit_push_unary(ff, FIT_NEG); }
+| Expression POWER Expression { fit_push_binary(ff, FIT_POW); }
+| LEFT Expression RIGHT { }
+| LOG LEFT Expression RIGHT { fit_push_unary(ff, FIT_LOG); }
+| LN LEFT Expression RIGHT { fit_push_unary(ff, FIT_LN); }
 ;
 
 %%
 
-int yyerror(char *s) {
+#undef yylex
+
+/* flex scanner interface (funceval.lex.c) */
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+int yylex(void);
+YY_BUFFER_STATE yy_scan_bytes(const char *bytes, int len);
+void yy_delete_buffer(YY_BUFFER_STATE b);
+int yylex_destroy(void);
+
+/* largest integer exponent that is expanded into multiplications */
+#define FIT_MAXPOWI		16
+
+/* compilation state: operand stack of node indices */
+static int fit_stack[FIT_MAXNODES];
+static int fit_sp;
+static int fit_err;
+
+/* scanner state: the function string is scanned in segments delimited by X */
+static char *seg_next;
+static int seg_var;
+static YY_BUFFER_STATE seg_buf;
+
+void yyerror(struct fitfunc_t *ff, const char *s) {
   fprintf(stderr, "%s\n", s);
 }
 
 /**
- * Parses the expression of load as a function of delay and returns the result.
- * Function is supposed to be the string read from the configuration file, e.g.,
- * e^-(1.08X) +5*e^(2*X). The name of the variable is *strictly* X and will be
- * replaced by the value of the delay argument.
+ * Scan the next segment of the function string. Returns 1 if the segment
+ * is followed by the variable.
  */
-double map_to_load(char *function, double delay, int *err) {
-	double retval;
-	char *saveptr;
-	char *token;
-	char strdelay[32];
-	memset(strdelay, 0, 32);
-	sprintf(strdelay, "%f", delay);
+static int fit_next_segment() {
+	char *end = strchr(seg_next, 'X');
+	int len = end ? end - seg_next : strlen(seg_next);
+
+	if (seg_buf) yy_delete_buffer(seg_buf);
+	seg_buf = yy_scan_bytes(seg_next, len);
+	seg_next += len + (end ? 1 : 0);
+	return end != NULL;
+}
+
+/**
+ * Token source for the parser. The scanner knows nothing about X, so it is
+ * handed the text between variables and a VAR token is returned whenever a
+ * segment is exhausted and a variable follows.
+ */
+int fitfunc_lex() {
+	int tok = yylex();
+	if (!tok && seg_var) {
+		seg_var = fit_next_segment();
+		return VAR;
+	}
+	return tok;
+}
+
+/**
+ * Apply an operation to its operand values.
+ */
+static inline double fit_apply(struct fitnode_t *n, double a, double b) {
+	double r;
+	int i;
+
+	switch (n->op) {
+		case FIT_ADD:	return a + b;
+		case FIT_SUB:	return a - b;
+		case FIT_MUL:	return a * b;
+		case FIT_DIV:	return a / b;
+		case FIT_POW:	return pow(a, b);
+		case FIT_EXP:	return exp(a);
+		case FIT_NEG:	return -a;
+		case FIT_LOG:	return log10(a);
+		case FIT_LN:	return log(a);
+		case FIT_POWI:
+			r = a;
+			for (i = 1; i < (int)n->value; i++) r *= a;
+			return r;
+	}
+	return n->value;
+}
+
+/**
+ * Add a node to the function, unless an identical one already exists, and
+ * return its index. Operations on constants are folded, powers of e and
+ * small integer powers are turned into cheaper operations.
+ */
+static int fit_node(struct fitfunc_t *ff, int op, int left, int right, double value) {
+	struct fitnode_t n;
+	struct fitnode_t *l = &ff->nodes[left];
+	struct fitnode_t *r = &ff->nodes[right];
+	int unary = (op == FIT_NEG || op == FIT_LOG || op == FIT_LN || op == FIT_EXP || op == FIT_POWI);
+	int i;
+
+	memset(&n, 0, sizeof(struct fitnode_t));
+	n.op = op;
+	n.value = value;
+
+	if (op != FIT_CONST && op != FIT_VAR) {
+		n.left = left;
+		if (!unary) n.right = right;
+
+		if (l->op == FIT_CONST && (unary || r->op == FIT_CONST)) {
+			/* constant folding */
+			n.value = fit_apply(&n, l->value, r->value);
+			n.op = FIT_CONST;
+			n.left = n.right = 0;
+		}
+		else if (op == FIT_POW && l->op == FIT_CONST && l->value == M_E) {
+			return fit_node(ff, FIT_EXP, right, 0, 0.0);
+		}
+		else if (op == FIT_POW && r->op == FIT_CONST && r->value == floor(r->value) && r->value >= 1 && r->value <= FIT_MAXPOWI) {
+			if (r->value == 1) return left;
+			return fit_node(ff, FIT_POWI, left, 0, r->value);
+		}
+		else if ((op == FIT_ADD || op == FIT_MUL) && left > right) {
+			/* canonical operand order for commutative operations */
+			n.left = right;
+			n.right = left;
+		}
+	}
+
+	/* common subexpression */
+	for (i = 0; i < ff->nnodes; i++) {
+		if (!memcmp(&ff->nodes[i], &n, sizeof(struct fitnode_t))) {
+			return i;
+		}
+	}
 
+	if (ff->nnodes == FIT_MAXNODES) {
+		fit_err = 1;
+		return 0;
+	}
+	ff->nodes[ff->nnodes] = n;
+	return ff->nnodes++;
+}
+
+static void fit_push_leaf(struct fitfunc_t *ff, int op, double value) {
+	if (fit_sp == FIT_MAXNODES) {
+		fit_err = 1;
+		return;
+	}
+	fit_stack[fit_sp++] = fit_node(ff, op, 0, 0, value);
+}
+
+static void fit_push_unary(struct fitfunc_t *ff, int op) {
+	if (fit_sp < 1) {
+		fit_err = 1;
+		return;
+	}
+	fit_stack[fit_sp - 1] = fit_node(ff, op, fit_stack[fit_sp - 1], 0, 0.0);
+}
+
+static void fit_push_binary(struct fitfunc_t *ff, int op) {
+	if (fit_sp < 2) {
+		fit_err = 1;
+		return;
+	}
+	fit_sp--;
+	fit_stack[fit_sp - 1] = fit_node(ff, op, fit_stack[fit_sp - 1], fit_stack[fit_sp], 0.0);
+}
+
+/**
+ * Drop nodes the result does not depend on (e.g., folded constants) so that
+ * the result ends up in the last node.
+ */
+static void fit_compact(struct fitfunc_t *ff, int root) {
+	int used[FIT_MAXNODES];
+	int i, j;
+
+	memset(used, 0, sizeof(used));
+	used[root] = 1;
+	for (i = root; i >= 0; i--) {
+		if (!used[i] || ff->nodes[i].op == FIT_CONST || ff->nodes[i].op == FIT_VAR) continue;
+		used[ff->nodes[i].left] = 1;
+		if (ff->nodes[i].op != FIT_NEG && ff->nodes[i].op != FIT_LOG && ff->nodes[i].op != FIT_LN
+			&& ff->nodes[i].op != FIT_EXP && ff->nodes[i].op != FIT_POWI) {
+			used[ff->nodes[i].right] = 1;
+		}
+	}
+
+	/* renumber: used[] becomes the new index of each kept node */
+	for (i = 0, j = 0; i <= root; i++) {
+		if (!used[i]) continue;
+		ff->nodes[j] = ff->nodes[i];
+		ff->nodes[j].left = used[ff->nodes[i].left];
+		ff->nodes[j].right = used[ff->nodes[i].right];
+		if (ff->nodes[j].op == FIT_CONST || ff->nodes[j].op == FIT_VAR) {
+			ff->nodes[j].left = ff->nodes[j].right = 0;
+		}
+		used[i] = j++;
+	}
+	ff->nnodes = j;
+}
+
+/**
+ * Parses the expression of load as a function of delay into func. Function is
+ * supposed to be the string read from the configuration file, e.g.,
+ * e^-(1.08X) +5*e^(2*X). The name of the variable is *strictly* X.
+ * Returns 0 on success or -1 if the expression is not valid.
+ */
+int compile_fitfunc(char *function, struct fitfunc_t *func) {
 	char function_copy[strlen(function) + 2];
+	int ret;
+
+	memset(func, 0, sizeof(struct fitfunc_t));
 	memset(function_copy, 0, strlen(function) + 2);
-	sprintf(function_copy, "%s\n\0", function);
-
-	//function with X replaced with actual value
-	char toparse[256];
-	memset(toparse, 0, 256);
-	char *ptr = toparse;
-
-	//replace variable--split string and concat...
-	token = strtok_r(function_copy, "X", &saveptr);
-	do {
-		if (!token) break;
-		strcpy(ptr, token);
-		ptr += strlen(token);
-		if ( (token = strtok_r(NULL, "X", &saveptr))  || function[strlen(function) - 1] == 'X') {
-			strcpy(ptr, strdelay);
-			ptr += strlen(strdelay);
-		}
-	} while (1);
+	sprintf(function_copy, "%s\n", function);
+
+	fit_sp = 0;
+	fit_err = 0;
+	seg_buf = NULL;
+	seg_next = function_copy;
+	seg_var = fit_next_segment();
 
-	yy_scan_string(toparse);
-	*err = 0;
-	if (yyparse(&retval)) *err = 1;
+	ret = yyparse(func);
 	yylex_destroy();
-	return retval;
+	seg_buf = NULL;
+
+	if (ret || fit_err || fit_sp != 1) {
+		memset(func, 0, sizeof(struct fitfunc_t));
+		return -1;
+	}
+
+	fit_compact(func, fit_stack[0]);
+	return 0;
 }
 
+/**
+ * Evaluates a compiled fit function for the given delay value.
+ */
+double map_to_load(struct fitfunc_t *func, double delay) {
+	double v[FIT_MAXNODES];
+	struct fitnode_t *n;
+	int i;
+
+	for (i = 0; i < func->nnodes; i++) {
+		n = &func->nodes[i];
+		if (n->op == FIT_CONST) {
+			v[i] = n->value;
+		}
+		else if (n->op == FIT_VAR) {
+			v[i] = delay;
+		}
+		else {
+			v[i] = fit_apply(n, v[n->left], v[n->right]);
+		}
+	}
+	return v[func->nnodes - 1];
+}
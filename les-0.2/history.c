@@ -0,0 +1,163 @@
+/**
+ * history.c -- In-memory load history of a path.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "history.h"
+
+static const int tier_res[HISTORY_NTIERS] = HISTORY_TIER_RES;
+static const int tier_len[HISTORY_NTIERS] = HISTORY_TIER_LEN;
+
+/**
+ * Index of the first bucket of a tier.
+ */
+static int history_tier_offset(int tier) {
+	int off = 0;
+	int i;
+
+	for (i = 0; i < tier; i++) off += tier_len[i];
+	return off;
+}
+
+/**
+ * Add a load sample taken at time t (usec since the epoch). Samples are
+ * expected in time order.
+ */
+void history_add(struct history_t *h, long long t, double load) {
+	struct history_bucket_t *b;
+	long long res;
+	long long idx;
+	int off = 0;
+	int i;
+
+	seqlock_write_begin(&h->seqlock);
+
+	b = &h->raw[h->nraw % HISTORY_RAWLEN];
+	b->start = t;
+	b->count = 1;
+	b->min = b->max = b->sum = b->last = load;
+	h->nraw++;
+	h->last = t;
+
+	for (i = 0; i < HISTORY_NTIERS; off += tier_len[i], i++) {
+		res = (long long)tier_res[i] * 1000000;
+		idx = t / res;
+		b = &h->buckets[off + idx % tier_len[i]];
+		if (b->start != idx * res || !b->count) {
+			/* first sample of the interval; the slot held an older one */
+			b->start = idx * res;
+			b->count = 1;
+			b->min = b->max = b->sum = b->last = load;
+			continue;
+		}
+		b->count++;
+		if (load < b->min) b->min = load;
+		if (load > b->max) b->max = load;
+		b->sum += load;
+		b->last = load;
+	}
+
+	seqlock_write_end(&h->seqlock);
+}
+
+/**
+ * Copy the raw samples in [from, to) to out (see history_query()).
+ */
+static int history_query_raw(struct history_t *h, long long from, long long to, struct history_bucket_t *out, int max,
+	long long *next) {
+	struct history_bucket_t *b;
+	unsigned int i;
+	unsigned int first = h->nraw > HISTORY_RAWLEN ? h->nraw - HISTORY_RAWLEN : 0;
+	int n = 0;
+
+	for (i = first; i != h->nraw; i++) {
+		b = &h->raw[i % HISTORY_RAWLEN];
+		if (b->start < from) continue;
+		if (b->start >= to) break;
+		if (n == max) {
+			*next = b->start;
+			break;
+		}
+		out[n++] = *b;
+	}
+	return n;
+}
+
+/**
+ * Copy the buckets of a tier in [from, to) to out (see history_query()).
+ */
+static int history_query_tier(struct history_t *h, int tier, long long from, long long to, struct history_bucket_t *out,
+	int max, long long *next) {
+	struct history_bucket_t *buckets = &h->buckets[history_tier_offset(tier)];
+	struct history_bucket_t *b;
+	long long res = (long long)tier_res[tier] * 1000000;
+	long long newest = h->last / res;
+	long long idx = from / res;
+	long long last = (to - 1) / res;
+	int n = 0;
+
+	/* older buckets have been overwritten */
+	if (idx <= newest - tier_len[tier]) idx = newest - tier_len[tier] + 1;
+	if (last > newest) last = newest;
+
+	for (; idx <= last; idx++) {
+		b = &buckets[idx % tier_len[tier]];
+		if (!b->count || b->start != idx * res) continue;
+		if (n == max) {
+			*next = b->start;
+			break;
+		}
+		out[n++] = *b;
+	}
+	return n;
+}
+
+/**
+ * Copy up to max buckets starting in [from, to) (usec since the epoch) to
+ * out, in time order, and return their number. Buckets come from the
+ * coarsest tier with a resolution of at most res seconds, or are raw samples
+ * if res is 0; that resolution is stored to actual_res. If there are more
+ * than max buckets, next is set to the start of the first bucket left out,
+ * otherwise to 0.
+ */
+int history_query(struct history_t *h, int res, long long from, long long to, struct history_bucket_t *out, int max,
+	int *actual_res, long long *next) {
+	unsigned int seq;
+	int tier = -1;
+	int n;
+	int i;
+
+	for (i = 0; i < HISTORY_NTIERS && res > 0; i++) {
+		if (tier_res[i] <= res) tier = i;
+	}
+	if (res > 0 && tier < 0) tier = 0;
+	*actual_res = tier < 0 ? 0 : tier_res[tier];
+
+	do {
+		seq = seqlock_read_begin(&h->seqlock);
+		*next = 0;
+		if (tier < 0) {
+			n = history_query_raw(h, from, to, out, max, next);
+		}
+		else {
+			n = history_query_tier(h, tier, from, to, out, max, next);
+		}
+	} while (seqlock_read_retry(&h->seqlock, seq));
+
+	return n;
+}
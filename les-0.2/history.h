@@ -0,0 +1,85 @@
+/**
+ * history.h -- In-memory load history of a path: the most recent samples,
+ * plus per second, minute and hour rollups (min, max, mean and last load)
+ * over longer horizons. Everything lives in fixed size rings allocated with
+ * the path, so memory use does not grow with uptime.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+#include <string.h>
+
+#include "seqlock.h"
+
+/* most recent samples kept */
+#define HISTORY_RAWLEN		1024
+
+/* rollup tiers: resolution (sec) and number of buckets of each */
+#define HISTORY_NTIERS		3
+#define HISTORY_TIER_RES	{1, 60, 3600}
+#define HISTORY_TIER_LEN	{600, 1440, 720} /* 10 min, 1 day, 30 days */
+#define HISTORY_NBUCKETS	(600 + 1440 + 720)
+
+/**
+ * Load statistics of a time interval. A raw sample is a bucket of a single
+ * sample.
+ */
+struct history_bucket_t {
+	/* start of the interval (usec since the epoch) */
+	long long start;
+	unsigned int count;
+	double min;
+	double max;
+	double sum;
+	double last;
+};
+
+/**
+ * Written by the device thread only; readers copy under the seqlock.
+ */
+struct history_t {
+	struct seqlock_t seqlock;
+	/* samples added so far; raw[i % HISTORY_RAWLEN] is sample i */
+	unsigned int nraw;
+	struct history_bucket_t raw[HISTORY_RAWLEN];
+	/* buckets of all tiers, one after the other */
+	struct history_bucket_t buckets[HISTORY_NBUCKETS];
+	/* time of the last sample */
+	long long last;
+};
+
+/**
+ * Add a load sample taken at time t (usec since the epoch). Samples are
+ * expected in time order.
+ */
+void history_add(struct history_t *h, long long t, double load);
+
+/**
+ * Copy up to max buckets starting in [from, to) (usec since the epoch) to
+ * out, in time order, and return their number. Buckets come from the
+ * coarsest tier with a resolution of at most res seconds, or are raw samples
+ * if res is 0; that resolution is stored to actual_res. If there are more
+ * than max buckets, next is set to the start of the first bucket left out,
+ * otherwise to 0.
+ */
+int history_query(struct history_t *h, int res, long long from, long long to, struct history_bucket_t *out, int max,
+	int *actual_res, long long *next);
+
+#endif
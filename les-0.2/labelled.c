@@ -0,0 +1,69 @@
+/**
+ * labelled.c -- Delay samples labelled with the actual load.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "labelled.h"
+
+/**
+ * Read a labelled trace. Loads are divided by scale and capped to 1, or set
+ * to 0 if not above zeroload. Lines that do not parse and non-positive delays
+ * (which the server ignores too) are skipped. Returns 0 on success or -1 on
+ * error.
+ */
+int labelled_load(char *fname, double scale, double zeroload, struct labelled_t *l) {
+	char line[256];
+	double load;
+	double delay;
+	int size = 0;
+	FILE *f;
+
+	memset(l, 0, sizeof(struct labelled_t));
+	f = fopen(fname, "r");
+	if (!f) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%lf %lf", &load, &delay) != 2 || delay <= 0) {
+			continue;
+		}
+		if (l->n == size) {
+			size = size ? 2 * size : 4096;
+			l->delay = (long long*)realloc(l->delay, size * sizeof(long long));
+			l->actual = (double*)realloc(l->actual, size * sizeof(double));
+			if (!l->delay || !l->actual) {
+				fclose(f);
+				return -1;
+			}
+		}
+		l->delay[l->n] = (long long)delay;
+		l->actual[l->n] = load <= zeroload ? 0.0 : fmin(load / scale, 1.0);
+		l->n++;
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+ * Free the samples of a labelled trace.
+ */
+void labelled_free(struct labelled_t *l) {
+	free(l->delay);
+	free(l->actual);
+	memset(l, 0, sizeof(struct labelled_t));
+}
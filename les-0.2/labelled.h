@@ -0,0 +1,57 @@
+/**
+ * labelled.h -- Delay samples labelled with the actual load, as recorded in
+ * the evaluation experiments (see evaluation/les-eval.py): a line per sample
+ * with the actual load (bit/s) and the delay (nsec), separated by whitespace;
+ * further fields are ignored.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _LABELLED_H_
+#define _LABELLED_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* defaults, as in evaluation/les-eval.py */
+#define LABELLED_SCALE		50000000.0 /* load (bit/s) reported as 1 */
+#define LABELLED_ZEROLOAD	9000000.0 /* loads up to this are reported as 0 */
+
+struct labelled_t {
+	/* delay samples (nsec) */
+	long long *delay;
+	/* actual load, in [0, 1] */
+	double *actual;
+	int n;
+};
+
+/**
+ * Read a labelled trace. Loads are divided by scale and capped to 1, or set
+ * to 0 if not above zeroload. Lines that do not parse and non-positive delays
+ * (which the server ignores too) are skipped. Returns 0 on success or -1 on
+ * error.
+ */
+int labelled_load(char *fname, double scale, double zeroload, struct labelled_t *l);
+
+/**
+ * Free the samples of a labelled trace.
+ */
+void labelled_free(struct labelled_t *l);
+
+#endif
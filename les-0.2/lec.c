@@ -20,27 +20,481 @@
 
 #include "protocol.h"
 #include "netfunc.h"
+#include "qsketch.h"
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/time.h>
 
-int main() {
+/* requests not answered within this many msec count as timed out */
+#define LEC_TIMEOUT		1000
+
+/* LES instance queried (-H, -P and -T options) */
+char *server_host = "127.0.0.1";
+int server_port = 7575;
+int server_proto = _PROTO_UDP_;
+
+/**
+ * A client of the load generator, run by its own thread.
+ */
+struct loadgen_client_t {
+	pthread_t thread;
+	struct cnx_info_t info;
+	/* first request time and interval (nsec since the start; 0: closed loop) */
+	long long first;
+	long long interval;
+	/* request latencies (nsec) */
+	struct qsketch_t latency;
+	long long max_latency;
+	unsigned int sent;
+	unsigned int ok;
+	unsigned int errors;
+	unsigned int timeouts;
+};
+
+/* load generator request, start and duration (nsec) */
+char loadgen_request[REACTOR_BUFLEN];
+int loadgen_reqlen;
+struct timespec loadgen_start;
+long long loadgen_duration;
+
+/**
+ * Connect to the LES instance with the given protocol. Returns the socket
+ * descriptor or < 0 on error.
+ */
+int connect_server(struct cnx_info_t *info, int proto) {
+    info->proto = proto;
+    strncpy(info->host, server_host, 79);
+    info->host[79] = '\0';
+    info->port = server_port;
+    return init_client_connection(info);
+}
+
+/**
+ * Subscribe to load updates over TCP and print them as they are pushed.
+ */
+int subscribe(double min_change, int min_interval) {
+    struct cnx_info_t info;
+    char data[REACTOR_BUFLEN];
+    int len = 0;
+    int msize = 0;
+    int mtype;
+    int n;
+
+    if (connect_server(&info, _PROTO_TCP_) < 0) {
+		return 1;
+    }
+
+    n = render_subscribe_request(min_change, min_interval, data, REACTOR_BUFLEN);
+    write_data(&info, data, n, TO_SERVER);
+
+    while ((n = recv(info.sockfd, data + len, REACTOR_BUFLEN - len, 0)) > 0) {
+		len += n;
+		while ((msize = frame_protocol_message(data, len, &mtype)) > 0) {
+			fwrite(data, 1, msize, stderr);
+			fprintf(stderr, "\n");
+			memmove(data, data + msize, len - msize);
+			len -= msize;
+		}
+		if (msize < 0) break;
+    }
+    close(info.sockfd);
+    return 0;
+}
+
+/**
+ * Print load information received in a binary LRSP message.
+ */
+void print_load_info_bin(struct load_info_t *linfo) {
+	fprintf(stderr, "Path: %d\nSeq: %u\nTimestamp: %lld\nStatus: %d\nDelay-avg: %f\nDelay-min: %lld\nDelay-max: %lld\nSamples: %d\nLoad-type: %1.3f\n",
+		linfo->path, linfo->seq, linfo->timestamp, linfo->status, linfo->weighted_avg, linfo->min, linfo->max, linfo->nsamples, linfo->load_type);
+}
+
+/**
+ * Receive load updates multicast by LES and print them, reporting updates
+ * lost on the way (sequence numbers are per path).
+ */
+int receive_multicast(char *group, int port) {
+    struct cnx_info_t info;
+    struct load_info_t linfo;
+    char data[REACTOR_BUFLEN];
+    /* expected sequence number per path, as each path has its own */
+    unsigned int next[LES_MAXPATHS];
+    int seen[LES_MAXPATHS];
+    int n;
+
+    strncpy(info.host, group, 79);
+    info.host[79] = '\0';
+    info.port = port;
+    if (init_multicast_receiver(&info) < 0) {
+		fprintf(stderr, "Could not join multicast group %s\n", group);
+		return 1;
+    }
+
+    memset(seen, 0, sizeof(seen));
+    while ((n = recv(info.sockfd, data, REACTOR_BUFLEN, 0)) >= 0) {
+		if (parse_load_response_bin(data, n, &linfo) < 0) continue;
+		if (linfo.path >= 0 && linfo.path < LES_MAXPATHS) {
+			if (seen[linfo.path] && linfo.seq != next[linfo.path]) {
+				fprintf(stderr, "Lost: %u (path %d)\n", linfo.seq - next[linfo.path], linfo.path);
+			}
+			seen[linfo.path] = 1;
+			next[linfo.path] = linfo.seq + 1;
+		}
+		print_load_info_bin(&linfo);
+		fprintf(stderr, "\n");
+    }
+    close(info.sockfd);
+    return 0;
+}
+
+/**
+ * Query the load history of the last given seconds at resolution res (0 for
+ * raw samples) and print the HRSP messages, following Next lines until the
+ * whole range has been received.
+ */
+int query_history(int seconds, int res, char *pathname) {
+    struct cnx_info_t info;
+    struct timeval tv;
+    char reply[REACTOR_REPLYLEN + 1];
+    char *next;
+    long long from;
+    long long to;
+    int len;
+    int msize;
+    int mtype;
+    int n;
+
+    if (connect_server(&info, server_proto) < 0) {
+		return 1;
+    }
+
+    /* fix the range, so that pages line up */
+    gettimeofday(&tv, NULL);
+    to = (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+    from = to - (long long)seconds * 1000000;
+
+    while (1) {
+		n = render_history_request(pathname, from, to, res, reply, sizeof(reply));
+		write_data(&info, reply, n, TO_SERVER);
+
+		/* an HRSP may arrive in several segments over TCP */
+		len = 0;
+		while ((msize = frame_protocol_message(reply, len, &mtype)) == 0 && len < (int)sizeof(reply) - 1) {
+			n = recv(info.sockfd, reply + len, sizeof(reply) - 1 - len, 0);
+			if (n <= 0) break;
+			len += n;
+		}
+		if (msize <= 0) {
+			close(info.sockfd);
+			return 1;
+		}
+		reply[msize] = 0;
+		fprintf(stderr, "%s", reply);
+
+		next = strstr(reply, "\r\nNext: ");
+		if (!next) break;
+		from = (long long)(strtod(next + 8, NULL) * 1000000);
+    }
+    close(info.sockfd);
+    return 0;
+}
+
+/**
+ * Nanoseconds elapsed since the load generator started.
+ */
+long long loadgen_now() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long)(now.tv_sec - loadgen_start.tv_sec) * 1000000000 + (now.tv_nsec - loadgen_start.tv_nsec);
+}
+
+/**
+ * Wait for the reply to a request sent at time sent, until LEC_TIMEOUT msec
+ * after it. Returns the message type, -1 if the reply is not valid or the
+ * connection failed, or 0 on timeout.
+ */
+int loadgen_reply(struct loadgen_client_t *c, long long sent) {
+    struct pollfd pfd = {c->info.sockfd, POLLIN, 0};
+    char data[REACTOR_REPLYLEN];
+    long long left;
+    int len = 0;
+    int msize;
+    int mtype;
+    int n;
+
+    while (1) {
+		left = (long long)LEC_TIMEOUT * 1000000 - (loadgen_now() - sent);
+		if (left <= 0 || poll(&pfd, 1, (int)((left + 999999) / 1000000)) == 0) {
+			return 0;
+		}
+		n = recv(c->info.sockfd, data + len, sizeof(data) - len, 0);
+		if (n <= 0) {
+			return -1;
+		}
+		len += n;
+		msize = frame_protocol_message(data, len, &mtype);
+		if (msize > 0) {
+			return mtype;
+		}
+		/* a datagram carries a whole message */
+		if (msize < 0 || c->info.proto == _PROTO_UDP_ || len == sizeof(data)) {
+			return -1;
+		}
+    }
+}
+
+/**
+ * Client thread: send requests until the end of the test, one at a time, and
+ * record their latencies. In open loop, requests are due every interval and
+ * latency is measured from when a request was due, so that a slow server
+ * cannot hide queueing by delaying the requests themselves.
+ */
+void *loadgen_run(void *arg) {
+    struct loadgen_client_t *c = (struct loadgen_client_t*)arg;
+    struct timespec due;
+    char stale[REACTOR_REPLYLEN];
+    long long next = c->first;
+    long long sent;
+    long long latency;
+    int ret;
+
+    while (1) {
+		sent = loadgen_now();
+		if (c->interval) {
+			if (next >= loadgen_duration) break;
+			if (next > sent) {
+				due.tv_sec = loadgen_start.tv_sec + (loadgen_start.tv_nsec + next) / 1000000000;
+				due.tv_nsec = (loadgen_start.tv_nsec + next) % 1000000000;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+			}
+			sent = next;
+			next += c->interval;
+		}
+		else if (sent >= loadgen_duration) {
+			break;
+		}
+
+		/* late replies to requests that timed out */
+		if (c->info.proto == _PROTO_UDP_) {
+			while (recv(c->info.sockfd, stale, sizeof(stale), MSG_DONTWAIT) > 0);
+		}
+
+		c->sent++;
+		if (write_data(&c->info, loadgen_request, loadgen_reqlen, TO_SERVER) != loadgen_reqlen) {
+			c->errors++;
+			continue;
+		}
+		ret = loadgen_reply(c, sent);
+		if (ret == MTYPE_LRSP) {
+			latency = loadgen_now() - sent;
+			qsketch_add(&c->latency, latency);
+			if (latency > c->max_latency) c->max_latency = latency;
+			c->ok++;
+			continue;
+		}
+		if (ret == 0) {
+			c->timeouts++;
+		}
+		else {
+			c->errors++;
+		}
+		if (c->info.proto == _PROTO_TCP_) {
+			/* the stream is out of step: start over */
+			close(c->info.sockfd);
+			if (connect_server(&c->info, _PROTO_TCP_) < 0) break;
+		}
+    }
+    close(c->info.sockfd);
+    return NULL;
+}
+
+/**
+ * Run nclients concurrent clients sending LREQ messages (for the given path,
+ * if not NULL; all paths, *, over UDP only) for the given number of seconds,
+ * either back to back (closed loop, rate 0) or at a total rate of requests
+ * per second (open loop), and report throughput and latency percentiles.
+ */
+int load_test(int nclients, int seconds, double rate, char *pathname) {
+    struct loadgen_client_t *clients;
+    struct qsketch_t *latency;
+    long long max_latency = 0;
+    unsigned int sent = 0, ok = 0, errors = 0, timeouts = 0;
+    double elapsed;
+    int i;
+
+    if (nclients <= 0 || seconds <= 0 || rate < 0) {
+		fprintf(stderr, "Invalid load test parameters\n");
+		return 1;
+    }
+    if (pathname && !strcmp(pathname, "*") && server_proto == _PROTO_TCP_) {
+		/* one LRSP per path follows on the stream, and the client cannot
+		 * tell which is the last one */
+		fprintf(stderr, "Load test of all paths (*) is only supported over UDP\n");
+		return 1;
+    }
+
+    loadgen_reqlen = render_load_request(pathname, loadgen_request, sizeof(loadgen_request));
+    loadgen_duration = (long long)seconds * 1000000000;
+    clients = (struct loadgen_client_t*)calloc(nclients, sizeof(struct loadgen_client_t));
+    latency = (struct qsketch_t*)calloc(1, sizeof(struct qsketch_t));
+    if (!clients || !latency) {
+		return 1;
+    }
+
+    for (i = 0; i < nclients; i++) {
+		if (connect_server(&clients[i].info, server_proto) < 0) {
+			fprintf(stderr, "Could not connect to %s:%d\n", server_host, server_port);
+			return 1;
+		}
+		if (rate > 0) {
+			/* spread the clients over the interval */
+			clients[i].interval = (long long)(nclients * 1e9 / rate);
+			clients[i].first = clients[i].interval * i / nclients;
+		}
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &loadgen_start);
+    for (i = 0; i < nclients; i++) {
+		pthread_create(&clients[i].thread, NULL, loadgen_run, &clients[i]);
+    }
+    for (i = 0; i < nclients; i++) {
+		pthread_join(clients[i].thread, NULL);
+		qsketch_merge(latency, &clients[i].latency);
+		if (clients[i].max_latency > max_latency) max_latency = clients[i].max_latency;
+		sent += clients[i].sent;
+		ok += clients[i].ok;
+		errors += clients[i].errors;
+		timeouts += clients[i].timeouts;
+    }
+    elapsed = loadgen_now() / 1e9;
+
+    fprintf(stderr, "Clients: %d (%s, %s)\nDuration: %.3f sec\nRequests: %u\nReplies: %u\nErrors: %u\nTimeouts: %u\n"
+		"Throughput: %.1f req/sec\n", nclients, server_proto == _PROTO_TCP_ ? "TCP" : "UDP",
+		rate > 0 ? "open loop" : "closed loop", elapsed, sent, ok, errors, timeouts, ok / elapsed);
+    if (ok) {
+		fprintf(stderr, "Latency p50: %.1f usec\nLatency p99: %.1f usec\nLatency p99.9: %.1f usec\nLatency max: %.1f usec\n",
+			qsketch_quantile(latency, 0.5) / 1e3, qsketch_quantile(latency, 0.99) / 1e3,
+			qsketch_quantile(latency, 0.999) / 1e3, max_latency / 1e3);
+    }
+
+    free(latency);
+    free(clients);
+    return 0;
+}
+
+int main(int argc, char **argv) {
     int mtype;
     int ret;
+    int binary = 0;
+    unsigned int path = 0;
+    char *pathname = NULL;
     char *message;
+    char data[REACTOR_BUFLEN]; /* read_data() reads up to 1024 bytes at once */
+    char reply[REACTOR_REPLYLEN + 1];
 	struct load_info_t *linfo = NULL;
     struct cnx_info_t info;
 
+    /* connection options come first */
+    while (argc >= 2) {
+		if (argc >= 3 && !strcmp(argv[1], "-H")) {
+			server_host = argv[2];
+		}
+		else if (argc >= 3 && !strcmp(argv[1], "-P")) {
+			server_port = atoi(argv[2]);
+		}
+		else if (!strcmp(argv[1], "-T")) {
+			server_proto = _PROTO_TCP_;
+			argc--;
+			argv++;
+			continue;
+		}
+		else {
+			break;
+		}
+		argc -= 2;
+		argv += 2;
+    }
+
+    if (argc >= 4 && argc <= 6 && !strcmp(argv[1], "-l")) {
+		return load_test(atoi(argv[2]), atoi(argv[3]), argc > 4 ? strtod(argv[4], NULL) : 0.0, argc > 5 ? argv[5] : NULL);
+    }
+    if (argc >= 2 && argc <= 4 && !strcmp(argv[1], "-s")) {
+		return subscribe(argc > 2 ? strtod(argv[2], NULL) : 0.0, argc > 3 ? atoi(argv[3]) : 0);
+    }
+    if (argc >= 3 && argc <= 4 && !strcmp(argv[1], "-m")) {
+		return receive_multicast(argv[2], argc > 3 ? atoi(argv[3]) : server_port + MCAST_PORT_OFFSET);
+    }
+    if (argc >= 3 && argc <= 5 && !strcmp(argv[1], "-h")) {
+		return query_history(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 60, argc > 4 ? argv[4] : NULL);
+    }
+    if (argc >= 2 && argc <= 3 && !strcmp(argv[1], "-b")) {
+		binary = 1;
+		path = argc > 2 ? (unsigned int)strtoul(argv[2], NULL, 10) : 0;
+    }
+    else if (argc == 3 && !strcmp(argv[1], "-p")) {
+		pathname = argv[2];
+    }
+    else if (argc != 1) {
+		fprintf(stderr, "Usage: lec [-H host] [-P port] [-T] [-b [path] | -p path | -s [min_change [min_interval]]\n"
+			"           | -m group [port] | -h seconds [resolution [path]] | -l clients seconds [rate [path]]]\n"
+			"  -H, -P: address of LES (default: 127.0.0.1, port 7575)\n"
+			"  -T: use TCP instead of UDP\n"
+			"  -b: use the binary protocol; path is the index of the path to query\n"
+			"  -p: query the path with the given name (* for all paths)\n"
+			"  -s: subscribe to load updates (TCP); push only changes of at least\n"
+			"      min_change, at most once every min_interval msec\n"
+			"  -m: receive load updates multicast to group (default port: -P port + 1)\n"
+			"  -h: print the load history of the last given seconds, in buckets of\n"
+			"      resolution seconds (default: 60, 0: raw samples)\n"
+			"  -l: load test: run clients concurrent clients for the given seconds,\n"
+			"      at a total rate of requests/sec (default: 0, back to back); path *\n"
+			"      (all paths) over UDP only\n");
+		return 1;
+    }
+
     /* init connection with LES */
-    info.proto = _PROTO_UDP_;
-    strcpy(info.host, "127.0.0.1");
-    info.port = 7575;
-    ret = init_client_connection(&info);
+    ret = connect_server(&info, server_proto);
     if (ret < 0) {
 		return 1;
     }
 
+    if (binary) {
+		/* send request and receive the fixed size response(s) */
+		ret = render_load_request_bin(path, data);
+		write_data(&info, data, ret, TO_SERVER);
+		ret = recv(info.sockfd, reply, sizeof(reply), 0);
+
+		linfo = (struct load_info_t*)malloc(sizeof(struct load_info_t));
+		for (message = reply; ret >= LBRSP_LEN; message += LBRSP_LEN, ret -= LBRSP_LEN) {
+			if (parse_load_response_bin(message, LBRSP_LEN, linfo) < 0) {
+				free(linfo);
+				return 1;
+			}
+			print_load_info_bin(linfo);
+		}
+		free(linfo);
+		return 0;
+    }
+
+    if (pathname) {
+		/* the responses for all paths arrive in a single datagram */
+		ret = render_load_request(pathname, reply, sizeof(reply));
+		write_data(&info, reply, ret, TO_SERVER);
+		ret = recv(info.sockfd, reply, sizeof(reply) - 1, 0);
+		if (ret <= 0) {
+			return 1;
+		}
+		reply[ret] = 0;
+		fprintf(stderr, "%s", reply);
+		return 0;
+    }
+
     /* send request */
     message = generate_load_request();
     xmit_protocol_message(&info, message, TO_SERVER);
@@ -62,4 +516,3 @@ int main() {
 
 	return 0;
 }
-
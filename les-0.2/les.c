@@ -23,154 +23,375 @@
 
 #include "les.h"
 
+/* delay percentiles reported in LRSP */
+static const double lrsp_pct[LRSP_NPCT] = LRSP_PCT;
+
 /**
  * Load estimation algorithm.
  */
-double estimate_load(struct les_params_t *params, struct window_t *window, long long sample) {
+double estimate_load(struct les_path_t *path, long long sample) {
+	struct les_params_t *params = &path->params;
+	struct load_info_t *delay_stats = &path->delay_stats;
+	struct window_t *window = &path->window;
+	struct timeval tv;
 	double retval;
-	int err;
-
-	pthread_mutex_lock(&mtx_delay_info);
+	double l;
+	int fit_error = 0;
+	int i;
 
 	/* some delay statistics */
-	delay_stats.nsamples++;
-	delay_stats.sample_sum += sample;
-	delay_stats.avg = ((double)delay_stats.sample_sum) / (double)delay_stats.nsamples;
-	delay_stats.weighted_avg = (1 - params->w)*(double)sample + params->w*delay_stats.weighted_avg;
-	if (sample > delay_stats.max) delay_stats.max = sample;
-	if (sample < delay_stats.min || delay_stats.min == 0) delay_stats.min = sample;
+	delay_stats->nsamples++;
+	delay_stats->sample_sum += sample;
+	delay_stats->avg = ((double)delay_stats->sample_sum) / (double)delay_stats->nsamples;
+	delay_stats->weighted_avg = (1 - params->w)*(double)sample + params->w*delay_stats->weighted_avg;
+	if (sample > delay_stats->max) delay_stats->max = sample;
+	if (sample < delay_stats->min || delay_stats->min == 0) delay_stats->min = sample;
+	gettimeofday(&tv, NULL);
+	delay_stats->timestamp = (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+
+	/* delay percentiles, O(log n) each */
+	qsketch_add(&path->delay_sketch, sample);
+	qwindow_add(&path->delay_window, delay_stats->timestamp, sample);
+	for (i = 0; i < LRSP_NPCT; i++) {
+		delay_stats->pct[i] = qsketch_quantile(&path->delay_window.total, lrsp_pct[i]);
+		delay_stats->pct_all[i] = qsketch_quantile(&path->delay_sketch, lrsp_pct[i]);
+	}
 
 	/* load to which current sample maps */
-	double l;
-
-	/* Add sample to window and slide it */
-	window_slide(&window, sample, params->winsize);
-
-	/* Calculate window average */
-	double avg = window_average(window);
-
-	/* If delay is below a threshold, consider current load as 0 */
-	if (avg < params->Dlow) {
-		l = 0.0;
-	}
-	else {
-		/* Otherwise, use curve. If curve value > 1.0, consider curr load as 1*/
-		l = fmin(map_to_load(params->fitfunc, avg, &err), 1.0);
+	l = estimator_instant(window, sample, params->Dlow, &params->fitcode, &params->table, &fit_error);
+	if (fit_error) {
+		metrics_inc(&path->fit_errors);
 	}
 
 	/* Update load estimate */
-	delay_stats.load_type = params->w*delay_stats.load_type + (1 - params->w)*l;
-	retval = delay_stats.load_type;
+	delay_stats->load_type = estimator_smooth(delay_stats->load_type, l, params->w);
+	retval = delay_stats->load_type;
+	pipetrace_stamp(&path->pipetrace, PIPETRACE_ESTIMATE);
 
-	pthread_mutex_unlock(&mtx_delay_info);
+	history_add(&path->history, delay_stats->timestamp, retval);
+	publish_load_info(path);
+	pipetrace_stamp(&path->pipetrace, PIPETRACE_PUBLISH);
 
 	return retval;
 }
 
 /**
- * Log a delay sample and the current load estimate with a local timestamp
+ * Publish the delay statistics of a path to request handlers, along with the
+ * LRSP messages that report them, and multicast the binary LRSP message if
+ * enabled.
  */
-void log_delay_sample(FILE *fp, long long sample, double load) {
-	char s[80];
-	char str_sec[32];
-	char timestamp[64];
-	struct tm ptm;
-	struct timeval tv;
-
-	if (!fp) return;
+void publish_load_info(struct les_path_t *path) {
+	char response[LRSP_MAXLEN];
+	char response_bin[LBRSP_LEN];
+	int len;
+
+	/* format outside the write section to keep it short */
+	path->delay_stats.seq++;
+	len = render_load_response(&path->delay_stats, npaths > 1 ? path->name : NULL, response, LRSP_MAXLEN);
+	render_load_response_bin(&path->delay_stats, response_bin);
+
+	seqlock_write_begin(&path->seqlock);
+	memcpy(&path->snapshot, &path->delay_stats, sizeof(struct load_info_t));
+	memcpy(path->response, response, len);
+	path->response_len = len;
+	memcpy(path->response_bin, response_bin, LBRSP_LEN);
+	seqlock_write_end(&path->seqlock);
+
+	/* wake up the reactor to push the update to subscribers */
+	reactor_notify(&reactor, path->delay_stats.path);
+
+	/* a single datagram reaches all multicast receivers */
+	if (mcast_enabled) {
+		write_data(&mcast, response_bin, LBRSP_LEN, TO_SERVER);
+	}
+}
 
-	memset(&tv, 0, sizeof(tv));
-	memset(&ptm, 0, sizeof(ptm));
-	memset(timestamp, 0, 64);
-	memset(str_sec, 0, 32);
-	memset(s, 0, 80);
+/**
+ * Copy current load information of a path to linfo. Never blocks the device
+ * thread.
+ */
+void get_load_info(struct les_path_t *path, struct load_info_t *linfo) {
+	unsigned int seq;
 
-	gettimeofday(&tv, NULL);
-	localtime_r(&tv.tv_sec, &ptm);
-	strftime(str_sec, 64, "%Y-%m-%d,%H:%M:%S", &ptm);
-	sprintf (timestamp, "%s.%03ld", str_sec, tv.tv_usec/1000);
+	do {
+		seq = seqlock_read_begin(&path->seqlock);
+		memcpy(linfo, &path->snapshot, sizeof(struct load_info_t));
+	} while (seqlock_read_retry(&path->seqlock, seq));
 
-	sprintf(s, "%s\t%Ld\t%f\n", timestamp, sample, load);
-	fwrite((void*)s, 1, strlen(s), fp);
-	fflush(fp);
+	/* todo: negative load for STATUS_DEV_UNAVAIL or xtra status fld in proto */
 }
 
 /**
- * Return current load information.
+ * Copy the current LRSP message of a path to buf (at least LRSP_MAXLEN bytes)
+ * and return its length. The binary variant is copied if mtype is
+ * MTYPE_LBREQ. Never blocks the device thread.
  */
-struct load_info_t *get_load_info() {
-	struct load_info_t *retval;
-	retval = (struct load_info_t*)malloc(sizeof(struct load_info_t));
-	memset(retval, 0, sizeof(struct load_info_t));
-
-	pthread_mutex_lock(&mtx_delay_info);
-	memcpy(retval, &delay_stats, sizeof(struct load_info_t));	
-	pthread_mutex_unlock(&mtx_delay_info);
+int get_load_response(struct les_path_t *path, int mtype, char *buf) {
+	unsigned int seq;
+	int len;
 
-	/* todo: negative load for STATUS_DEV_UNAVAIL or xtra status fld in proto */
+	pipetrace_served(&path->pipetrace);
+	do {
+		seq = seqlock_read_begin(&path->seqlock);
+		if (mtype == MTYPE_LBREQ) {
+			len = LBRSP_LEN;
+			memcpy(buf, path->response_bin, LBRSP_LEN);
+		}
+		else {
+			len = path->response_len;
+			memcpy(buf, path->response, LRSP_MAXLEN);
+		}
+	} while (seqlock_read_retry(&path->seqlock, seq));
 
-	return retval;
+	return len;
 }
 
 /**
- * Thread which communicates with the PTP device and maintains delay statistics.
- * Delay samples are also logged to a file. Configuration options are passed
- * in the params argument, which is supposed to be a struct les_params_t*.
+ * Return the index of the path with the given name (the first path if name
+ * is empty) or -1 if there is no such path.
  */
-void tfunc_delay_monitor(void *params) {
-	/* Log delay measurements here */
-	FILE *logfp;
+int find_path(char *name) {
+	int i;
 
-	/* init/config serial communication */
-	int fd = dev_init_comm( ((struct les_params_t*)params)->devname, ((struct les_params_t*)params)->devspeed);
-	if (fd < 0)  {
-		return;
+	if (!*name) return 0;
+	for (i = 0; i < npaths; i++) {
+		if (!strcasecmp(paths[i].name, name)) return i;
 	}
+	return -1;
+}
 
-	/* open log file */
-	logfp = fopen(((struct les_params_t*)params)->logfile, "w");
-	
-	//sync with data from serial port
-	dev_data_sync(fd);
+/**
+ * Return whether the service is stopping.
+ */
+int is_stopping() {
+	int stopval;
 
-	int i = 0;
-	int len = 0;
+	pthread_mutex_lock(&mtx_running);
+	stopval = stop;
+	pthread_mutex_unlock(&mtx_running);
+	return stopval;
+}
+
+/**
+ * Parse a line read from the PTP device (or trace) of a path into cur,
+ * update the load estimate and log the sample. Returns the ptp_parse_line()
+ * result.
+ */
+int process_line(struct les_path_t *path, char *line, struct ptp_sample_t *cur, struct line_state_t *st) {
 	long long sample;
-	char line[99]; //line data + \n\n
-	char lastline[99]; //previous line read
-	double load = 0;
+	int reason;
+	int flags;
 
-	memset(lastline, 0, 99);
-	do {
-		int stopval = 0;
-		pthread_mutex_lock(&mtx_running);
-		stopval = stop;
-		pthread_mutex_unlock(&mtx_running);
-		if (stopval) break;
+	if (__atomic_load_n(&path->reload, __ATOMIC_RELAXED)) {
+		apply_reload(path);
+	}
+	pipetrace_begin(&path->pipetrace);
+	metrics_inc(&path->lines);
+	reason = ptp_parse_line(line, cur);
+	if (reason != PTP_LINE_OK) {
+		/* report the first of a series of bad lines only */
+		if (reason != st->last_reason) {
+			fprintf(stderr, "Warning: path %s: dropped line (%s)\n", path->name, ptp_strerror(reason));
+		}
+		metrics_inc(&path->bad_lines[reason]);
+		st->last_reason = reason;
+		return reason;
+	}
+	st->last_reason = PTP_LINE_OK;
+	pipetrace_stamp(&path->pipetrace, PIPETRACE_PARSE);
+
+	flags = ptp_is_sync(&st->last, cur) ? 0 : ARCHIVE_DELAY_RESP;
+	sample = ptp_sample_delay(cur);
+	if (path->params.skipsync && !flags) {
+		//we ignore SYNC delay samples
+		metrics_inc(&path->sync_skipped);
+		st->last = *cur;
+		samplelog_push(&path->samplelog, cur, sample, st->load, ARCHIVE_IGNORED);
+		return reason;
+	}
+	if (sample > 0) {
+		st->last = *cur;
+		st->load = estimate_load(path, sample);
+		samplelog_push(&path->samplelog, cur, sample, st->load, flags);
+		pipetrace_stamp(&path->pipetrace, PIPETRACE_LOG);
+	}
+	else {
+		metrics_inc(&path->ignored);
+		samplelog_push(&path->samplelog, cur, sample, st->load, flags | ARCHIVE_IGNORED);
+	}
+	return reason;
+}
 
-		memset(line, 0, 99);
-		len = dev_read_line(fd, line, 98, 1200);
-		if (strlen(line) != 96) {
-			//resync
-			dev_data_sync(fd);
+/**
+ * Process the lines of the PTP device of a path until the service stops or
+ * the device cannot be read.
+ */
+void read_device(struct les_path_t *path, int fd) {
+	//records are split from whatever the serial port delivers
+	struct dev_reader_t *reader = &path->reader;
+	struct line_state_t st;
+	struct ptp_sample_t cur;
+	char line[PTP_LINE_LEN + 2]; //longer lines are truncated
+	int len;
+
+	dev_reader_init(reader, fd);
+	memset(&st, 0, sizeof(struct line_state_t));
+
+	while (!is_stopping()) {
+		len = dev_reader_next(reader, line, sizeof(line), 1200);
+		if (len == DEV_TIMEOUT) {
+			continue;
 		}
-		else {
-			if (((struct les_params_t*)params)->skipsync && is_sync(lastline, line)) {
-				//we ignore SYNC delay samples
-				memcpy(lastline, line, 99);
-				continue;
+		if (len == DEV_ERROR) {
+			fprintf(stderr, "Error: path %s: could not read from %s\n", path->name, path->params.devname);
+			break;
+		}
+		process_line(path, line, &cur, &st);
+	}
+}
+
+/**
+ * Nanoseconds elapsed on a clock since start.
+ */
+static long long elapsed_ns(clockid_t clock, struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(clock, &now);
+	return (long long)(now.tv_sec - start->tv_sec) * 1000000000 + (now.tv_nsec - start->tv_nsec);
+}
+
+/**
+ * Process the lines of a trace (replayspeed times faster than they were
+ * recorded according to T2, or as fast as possible if 0) replayrepeat
+ * times, then report the throughput.
+ */
+void read_trace(struct les_path_t *path, struct replay_t *trace) {
+	struct les_params_t *params = &path->params;
+	struct line_state_t st;
+	struct ptp_sample_t cur;
+	struct timespec wall, cpu, pcpu;
+	struct timespec base, due;
+	char line[PTP_LINE_LEN + 2]; //longer lines are truncated
+	long long base_t2 = 0;
+	long long prev_t2 = 0;
+	long long offset;
+	long long wall_ns, cpu_ns, pcpu_ns;
+	unsigned int nlines = 0;
+	int nsamples = path->delay_stats.nsamples;
+	int pass;
+
+	memset(&st, 0, sizeof(struct line_state_t));
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &pcpu);
+
+	for (pass = 0; pass < params->replayrepeat; pass++) {
+		replay_rewind(trace);
+		base_t2 = 0;
+		while (replay_next(trace, line, sizeof(line)) >= 0) {
+			/* the stop flag is checked once in a while at full speed */
+			if ((params->replayspeed > 0 || !(nlines & 1023)) && is_stopping()) {
+				pass = params->replayrepeat;
+				break;
 			}
-			sample = extract_sample_delay(line);
-			if (sample > 0) {
-				memcpy(lastline, line, 99);
-				load = estimate_load((struct les_params_t*)params, window, sample);
-				log_delay_sample(logfp, sample, load);
+			nlines++;
+
+			if (params->replayspeed > 0 && ptp_parse_line(line, &cur) == PTP_LINE_OK) {
+				/* wait until the line is due; restart the clock at the start of
+				 * a pass, if T2 goes back, or after an idle stretch */
+				if (!base_t2 || cur.t2 < prev_t2 || cur.t2 - prev_t2 > REPLAY_MAXGAP) {
+					base_t2 = cur.t2;
+					clock_gettime(CLOCK_MONOTONIC, &base);
+				}
+				prev_t2 = cur.t2;
+				offset = (long long)((cur.t2 - base_t2) / params->replayspeed);
+				due.tv_sec = base.tv_sec + (base.tv_nsec + offset) / 1000000000;
+				due.tv_nsec = (base.tv_nsec + offset) % 1000000000;
+				clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
 			}
+			process_line(path, line, &cur, &st);
+		}
+	}
+
+	wall_ns = elapsed_ns(CLOCK_MONOTONIC, &wall);
+	cpu_ns = elapsed_ns(CLOCK_THREAD_CPUTIME_ID, &cpu);
+	pcpu_ns = elapsed_ns(CLOCK_PROCESS_CPUTIME_ID, &pcpu);
+	if (!nlines) nlines = 1;
+	if (!wall_ns) wall_ns = 1;
+	fprintf(stderr, "Replay: path %s: %u lines (%d samples) in %.3f sec, %.0f lines/sec, CPU per line: %.3f usec (process: %.3f usec)\n",
+		path->name, nlines, path->delay_stats.nsamples - nsamples, wall_ns / 1e9, nlines * 1e9 / wall_ns,
+		cpu_ns / 1e3 / nlines, pcpu_ns / 1e3 / nlines);
+}
+
+/**
+ * Thread which communicates with the PTP device of a path (or replays its
+ * trace) and maintains its delay statistics. Delay samples are also logged
+ * to a file. The path is passed in the arg argument, which is supposed to be
+ * a struct les_path_t*.
+ */
+void tfunc_delay_monitor(void *arg) {
+	struct les_path_t *path = (struct les_path_t*)arg;
+	struct les_params_t *params = &path->params;
+	struct samplelog_conf_t logconf;
+	struct replay_t trace;
+	int replay = *params->replay != '\0';
+	int fd = -1;
+	int ret;
+
+	if (replay) {
+		if (replay_open(&trace, params->replay) < 0) {
+			fprintf(stderr, "Error: path %s: could not read %s\n", path->name, params->replay);
+			replay_finished();
+			return;
+		}
+	}
+	else {
+		/* init/config serial communication */
+		fd = dev_init_comm(params->devname, params->devspeed, &path->old_term);
+		if (fd < 0)  {
+			return;
 		}
-	} while(1);
+	}
+
+	/* open log file; samples are written out by another thread */
+	logconf.fname = params->logfile;
+	logconf.arcname = params->archive;
+	logconf.flush_interval = params->logflush;
+	logconf.flush_bytes = params->logflushbytes;
+	logconf.rotate_size = params->logrotatesize;
+	logconf.rotate_interval = params->logrotateinterval;
+	logconf.keep = params->logkeep;
+	logconf.compress = params->logcompress;
+	/* a trace replayed at full speed must not outrun the log */
+	logconf.lossless = replay && params->replayspeed == 0;
+	ret = samplelog_open(&path->samplelog, &logconf);
+	if (ret < 0) {
+		fprintf(stderr, "Warning: path %s: could not open %s\n", path->name, ret == -2 ? params->archive : params->logfile);
+	}
 
-	fclose(logfp);
-	dev_close(fd);
+	if (replay) {
+		read_trace(path, &trace);
+		samplelog_close(&path->samplelog);
+		replay_close(&trace);
+		replay_finished();
+	}
+	else {
+		read_device(path, fd);
+		samplelog_close(&path->samplelog);
+		dev_close(fd, &path->old_term);
+	}
+}
+
+/**
+ * Called when the trace of a path has been replayed. Once all paths are
+ * done, the service stops if no path reads a device.
+ */
+void replay_finished() {
+	if (__atomic_sub_fetch(&replays_running, 1, __ATOMIC_ACQ_REL) == 0 && nreplays == npaths) {
+		pthread_mutex_lock(&mtx_running);
+		stop = 1;
+		pthread_mutex_unlock(&mtx_running);
+	}
 }
 
 void term_handler(int signal) {
@@ -189,6 +410,50 @@ void term_handler(int signal) {
 	}
 }
 
+/**
+ * Reopen the sample output files, e.g., after they have been rotated by an
+ * external tool, and reload the configuration file (SIGHUP).
+ */
+void hup_handler(int signal) {
+	int i;
+	for (i = 0; i < npaths; i++) {
+		samplelog_reopen(&paths[i].samplelog);
+	}
+	/* reloaded by the main thread, which wakes up every second */
+	reload_requested = 1;
+}
+
+/**
+ * Request a dump of the pipeline traces (SIGUSR1).
+ */
+void usr1_handler(int signal) {
+	/* dumped by the main thread, which wakes up every second */
+	trace_dump_requested = 1;
+}
+
+/**
+ * Write the pipeline traces of all paths to the trace file, logging the
+ * outcome to syslog if tosyslog is set.
+ */
+void dump_pipetraces(int tosyslog) {
+	char message[320];
+	FILE *f;
+	int i;
+
+	f = fopen(trace_file, "w");
+	if (!f) {
+		snprintf(message, sizeof(message), "Warning: les: could not write pipeline traces to %s", trace_file);
+		log_message(LOG_WARNING, message, tosyslog);
+		return;
+	}
+	for (i = 0; i < npaths; i++) {
+		pipetrace_dump(&paths[i].pipetrace, paths[i].name, f);
+	}
+	fclose(f);
+	snprintf(message, sizeof(message), "les: pipeline traces written to %s", trace_file);
+	log_message(LOG_INFO, message, tosyslog);
+}
+
 /**
  * Log a message to syslog (should be open) or to stderr
  */
@@ -257,28 +522,678 @@ void daemonize(char *lockfile) {
 	signal(SIGTERM, term_handler);
 	signal(SIGKILL, term_handler);
 	signal(SIGINT, term_handler);
-	signal(SIGHUP, term_handler);
+	signal(SIGHUP, hup_handler);
+	signal(SIGUSR1, usr1_handler);
+}
+
+/**
+ * Answer an HREQ message of len bytes: render an HRSP message with the
+ * history of the requested path to reply and return its length.
+ */
+int get_history_response(char *data, int len, char *reply) {
+	struct history_bucket_t buckets[HRSP_MAXBUCKETS];
+	char name[LES_PATHNAMELEN];
+	struct timeval tv;
+	long long now;
+	long long from;
+	long long to;
+	long long next = 0;
+	int res;
+	int n = 0;
+	int i = -1;
+
+	if (parse_request_path(data, len, name, LES_PATHNAMELEN) == 0) {
+		i = find_path(name);
+	}
+	if (i < 0 || parse_history_request(data, len, &from, &to, &res) < 0) {
+		return render_history_response(STATUS_GEN_ERR, *name ? name : NULL, 0, NULL, 0, 0, reply, REACTOR_REPLYLEN);
+	}
+
+	gettimeofday(&tv, NULL);
+	now = (long long)tv.tv_sec * 1000000 + tv.tv_usec;
+	if (from <= 0) from += now;
+	if (to <= 0) to += now;
+
+	if (from < to) {
+		n = history_query(&paths[i].history, res, from, to, buckets, HRSP_MAXBUCKETS, &res, &next);
+	}
+	return render_history_response(STATUS_OK, npaths > 1 ? paths[i].name : NULL, res, buckets, n, next, reply,
+		REACTOR_REPLYLEN);
+}
+
+/**
+ * Serve a request (see handle_request()), setting *mtype to its type.
+ */
+int serve_request(char *data, int len, char *reply, int *replylen, struct subscription_t *sub, int *mtype) {
+	char name[LES_PATHNAMELEN];
+	struct load_info_t linfo;
+	unsigned int index;
+	int msize;
+	int i;
+
+	msize = frame_protocol_message(data, len, mtype);
+	if (msize <= 0) {
+		return msize;
+	}
+
+	if (*mtype == MTYPE_LBREQ) {
+		/* send the load responses rendered at the last update */
+		index = parse_load_request_bin(data, msize);
+		if (index == LB_ALLPATHS) {
+			for (i = 0; i < npaths; i++) {
+				*replylen += get_load_response(&paths[i], *mtype, reply + *replylen);
+			}
+		}
+		else if (index < npaths) {
+			*replylen = get_load_response(&paths[index], *mtype, reply);
+		}
+		else {
+			memset(&linfo, 0, sizeof(struct load_info_t));
+			linfo.status = STATUS_GEN_ERR;
+			linfo.path = index;
+			*replylen = render_load_response_bin(&linfo, reply);
+		}
+		return msize;
+	}
+
+	if (*mtype == MTYPE_HREQ) {
+		*replylen = get_history_response(data, msize, reply);
+		return msize;
+	}
+
+	if (*mtype != MTYPE_LREQ && (*mtype != MTYPE_SUBS || !sub)) {
+		return msize;
+	}
+
+	i = -1;
+	if (parse_request_path(data, msize, name, LES_PATHNAMELEN) == 0) {
+		if (*mtype == MTYPE_LREQ && !strcmp(name, PATH_ALL)) {
+			for (i = 0; i < npaths; i++) {
+				*replylen += get_load_response(&paths[i], *mtype, reply + *replylen);
+			}
+			return msize;
+		}
+		i = find_path(name);
+	}
+
+	if (i < 0) {
+		/* unknown path */
+		memset(&linfo, 0, sizeof(struct load_info_t));
+		linfo.status = STATUS_GEN_ERR;
+		*replylen = render_load_response(&linfo, name, reply, REACTOR_REPLYLEN);
+	}
+	else if (*mtype == MTYPE_LREQ) {
+		*replylen = get_load_response(&paths[i], *mtype, reply);
+	}
+	else {
+		if (parse_subscribe_request(data, msize, &sub->min_change, &sub->min_interval) < 0) {
+			return -1;
+		}
+		/* reply with the current load, then push updates */
+		sub->topic = i;
+		*replylen = push_load_update(i, reply, &sub->last_value);
+		sub->active = 1;
+	}
+	return msize;
+}
+
+/**
+ * Serve a request received by the reactor (see msg_handler_t in netfunc.h),
+ * counting it and its handling time in the counters of the calling thread.
+ */
+int handle_request(char *data, int len, char *reply, int *replylen, struct subscription_t *sub) {
+	struct timespec start, end;
+	int mtype = 0;
+	int type;
+	int ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = serve_request(data, len, reply, replylen, sub, &mtype);
+	if (ret == 0) {
+		return ret;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	switch (ret < 0 ? 0 : mtype) {
+		case MTYPE_LREQ:
+			type = REQ_LREQ;
+			break;
+		case MTYPE_LBREQ:
+			type = REQ_LBREQ;
+			break;
+		case MTYPE_SUBS:
+			type = REQ_SUBS;
+			break;
+		case MTYPE_HREQ:
+			type = REQ_HREQ;
+			break;
+		default:
+			type = REQ_INVALID;
+	}
+	metrics_local_add(type, 1);
+	metrics_local_observe(REQ_LATENCY, ((end.tv_sec - start.tv_sec) * 1000000000LL + end.tv_nsec - start.tv_nsec) / 1000);
+	return ret;
+}
+
+/**
+ * Copy the current LRSP message of path index topic to reply for subscribers
+ * and set value to the current load (see push_handler_t in netfunc.h).
+ */
+int push_load_update(int topic, char *reply, double *value) {
+	struct les_path_t *path = &paths[topic];
+	unsigned int seq;
+	int len;
+
+	pipetrace_served(&path->pipetrace);
+	do {
+		seq = seqlock_read_begin(&path->seqlock);
+		len = path->response_len;
+		memcpy(reply, path->response, LRSP_MAXLEN);
+		*value = path->snapshot.load_type;
+	} while (seqlock_read_retry(&path->seqlock, seq));
+
+	return len;
+}
+
+/**
+ * Register the counters of the service and its paths with the metrics
+ * registry.
+ */
+void register_metrics() {
+	static const char *reasons[PTP_NUM_REASONS] = {"ok", "length", "format", "timestamp", "range"};
+	static const char *reqtypes[NUM_REQTYPES] = {"lreq", "lbreq", "subs", "hreq", "invalid"};
+	struct les_path_t *path;
+	char labels[METRICS_LABELLEN];
+	int i, j;
+
+	for (i = 0; i < NUM_REQTYPES; i++) {
+		snprintf(labels, sizeof(labels), "type=\"%s\"", reqtypes[i]);
+		metrics_register_local("les_requests_total", "Requests served, per message type.", labels, i);
+	}
+	metrics_register_local_hist("les_request_duration_seconds", "Time to handle a request.", NULL, REQ_LATENCY);
+
+	for (i = 0; i < npaths; i++) {
+		path = &paths[i];
+		snprintf(labels, sizeof(labels), "path=\"%.*s\"", LES_PATHNAMELEN, path->name);
+		metrics_register("les_lines_total", "Lines read from the device.", labels, &path->lines, sizeof(unsigned int));
+		metrics_register("les_resyncs_total", "Times device input was skipped to find the next record.", labels,
+			&path->reader.resyncs, sizeof(unsigned int));
+		metrics_register("les_samples_total", "Delay samples used for load estimation.", labels,
+			&path->delay_stats.nsamples, sizeof(int));
+		metrics_register("les_sync_skipped_total", "SYNC delay samples skipped (skipsync).", labels,
+			&path->sync_skipped, sizeof(unsigned int));
+		metrics_register("les_samples_ignored_total", "Delay samples ignored for being non-positive.", labels,
+			&path->ignored, sizeof(unsigned int));
+		metrics_register("les_fitfunc_errors_total", "Fit function evaluations without a finite result.", labels,
+			&path->fit_errors, sizeof(unsigned int));
+		metrics_register("les_log_dropped_total", "Samples dropped from the output file queue.", labels,
+			&path->samplelog.dropped, sizeof(unsigned int));
+	}
+	for (i = 0; i < npaths; i++) {
+		path = &paths[i];
+		for (j = 1; j < PTP_NUM_REASONS; j++) {
+			snprintf(labels, sizeof(labels), "path=\"%.*s\",reason=\"%s\"", LES_PATHNAMELEN, path->name, reasons[j]);
+			metrics_register("les_bad_lines_total", "Malformed lines dropped, per reason.", labels,
+				&path->bad_lines[j], sizeof(unsigned int));
+		}
+	}
+}
+
+/**
+ * Set up the estimator parameters of a path from the per-path configuration
+ * values. Invalid values fall back to defaults.
+ */
+void load_path_params(char **confvalues, struct les_params_t *params) {
+	char *checkptr;
+
+	/* tty device */
+	if (!*confvalues[0]) {
+		strncpy(params->devname, DEF_TTYDEV, 80);
+	}
+	else {
+		strncpy(params->devname, confvalues[0], 80);
+	}
+
+	/* device speed */
+	if (!*confvalues[1]) {
+		if (!strncasecmp(confvalues[1], "115200", 6)) {
+			params->devspeed = B115200;
+		}
+		else if (!strncasecmp(confvalues[1], "9600", 6)) {
+			params->devspeed = B9600;
+		}
+		else if (!strncasecmp(confvalues[1], "38400", 6)) {
+			params->devspeed = B38400;
+		}
+		else {
+			/* default */
+			params->devspeed = DEF_TTYSPEED;
+		}
+	}
+	else {
+		params->devspeed = DEF_TTYSPEED;
+	}
+
+	/* fit function */
+	if (!*confvalues[2]) {
+		strcpy(params->fitfunc, DEF_FITFUNC);
+	}
+	else {
+		strcpy(params->fitfunc, confvalues[2]);
+	}
+	/* Compile the function once. If it is not syntactically correct, silently go back to default */
+	if (compile_fitfunc(params->fitfunc, &params->fitcode) < 0) {
+		memset(params->fitfunc, 0, 256);
+		strcpy(params->fitfunc, DEF_FITFUNC);
+		compile_fitfunc(params->fitfunc, &params->fitcode);
+	}
+
+	/* smoothing factor */
+	params->w = strtod(confvalues[3], &checkptr);
+	if (*checkptr != '\0') {
+		params->w = DEF_W;
+	}
+
+	/* window size */
+	params->winsize = strtol(confvalues[4], &checkptr, 10);
+	if (*checkptr != '\0' || params->winsize < 1) {
+		params->winsize = DEF_WINSIZE;
+	}
+
+	/* low load threshold (in nanosec) */
+	params->Dlow = strtod(confvalues[5], &checkptr);
+	if (*checkptr != '\0') {
+		params->Dlow = DEF_DLOW;
+	}
+
+	/* output file */
+	if (!*confvalues[10]) {
+		strncpy(params->logfile, DEF_OUTFILE, 80);
+	}
+	else {
+		strncpy(params->logfile, confvalues[10], 80);
+	}
+
+	/* ignore sync messages in load estimation */
+	params->skipsync = strtol(confvalues[11], &checkptr, 10);
+	if (*checkptr != '\0' || (params->skipsync != 0 && params->skipsync != 1) ) {
+		/* maybe value is given as yes/y/no/n */
+		if (!strncasecmp(confvalues[11], "y", 1)) {
+			params->skipsync = 1;
+		}
+		else 
+		if (!strncasecmp(confvalues[11], "n", 1)) {
+			params->skipsync = 0;
+		}
+		else {
+			params->skipsync = DEF_SKIPSYNC;
+		}
+	}
+
+	/* interpolation table size */
+	params->fittable = strtol(confvalues[12], &checkptr, 10);
+	if (*checkptr != '\0' || params->fittable < 0) {
+		params->fittable = DEF_FITTABLE;
+	}
+
+	/* max interpolation error */
+	params->fiterr = strtod(confvalues[13], &checkptr);
+	if (*checkptr != '\0' || !*confvalues[13] || params->fiterr <= 0) {
+		params->fiterr = DEF_FITERR;
+	}
+
+	/* binary sample archive */
+	strncpy(params->archive, confvalues[23], 80);
+
+	/* sample output file rotation */
+	params->logrotatesize = strtoll(confvalues[24], &checkptr, 10);
+	if (*checkptr == 'k' || *checkptr == 'K') {
+		params->logrotatesize <<= 10;
+		checkptr++;
+	}
+	else if (*checkptr == 'm' || *checkptr == 'M') {
+		params->logrotatesize <<= 20;
+		checkptr++;
+	}
+	if (*checkptr != '\0' || params->logrotatesize < 0) {
+		params->logrotatesize = DEF_LOGROTATESIZE;
+	}
+	params->logrotateinterval = strtol(confvalues[25], &checkptr, 10);
+	if (*checkptr != '\0' || params->logrotateinterval < 0) {
+		params->logrotateinterval = DEF_LOGROTATEINTERVAL;
+	}
+	params->logkeep = strtol(confvalues[26], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[26] || params->logkeep < 0) {
+		params->logkeep = DEF_LOGKEEP;
+	}
+	if (!strncasecmp(confvalues[27], "y", 1) || !strcmp(confvalues[27], "1")) {
+		params->logcompress = 1;
+	}
+	else if (!strncasecmp(confvalues[27], "n", 1) || !strcmp(confvalues[27], "0")) {
+		params->logcompress = 0;
+	}
+	else {
+		params->logcompress = DEF_LOGCOMPRESS;
+	}
+
+	/* sliding delay percentiles horizon (sec) */
+	params->pctwindow = strtol(confvalues[28], &checkptr, 10);
+	if (*checkptr != '\0' || params->pctwindow <= 0) {
+		params->pctwindow = DEF_PCTWINDOW;
+	}
+
+	/* trace replay */
+	strncpy(params->replay, confvalues[29], sizeof(params->replay) - 1);
+	params->replayspeed = strtod(confvalues[30], &checkptr);
+	if (*checkptr != '\0' || params->replayspeed < 0) {
+		params->replayspeed = DEF_REPLAYSPEED;
+	}
+	params->replayrepeat = strtol(confvalues[31], &checkptr, 10);
+	if (*checkptr != '\0' || params->replayrepeat <= 0) {
+		params->replayrepeat = DEF_REPLAYREPEAT;
+	}
+
+	/* sample output file flush interval (msec) and size */
+	params->logflush = strtol(confvalues[21], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[21] || params->logflush < 0) {
+		params->logflush = DEF_LOGFLUSH;
+	}
+	params->logflushbytes = strtol(confvalues[22], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[22] || params->logflushbytes < 0) {
+		params->logflushbytes = DEF_LOGFLUSHBYTES;
+	}
+
+	/* sample the fit function into the interpolation table */
+	if (params->fittable) {
+		fittable_build(&params->table, &params->fitcode, params->Dlow, params->fittable, params->fiterr);
+	}
+}
+
+/* indices of the configuration options that may be set per path */
+static const int path_options[] = {0, 1, 2, 3, 4, 5, 10, 11, 12, 13, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, -1};
+
+/* indices of the options that can change while running (SIGHUP) */
+static const int reload_options[] = {2, 3, 4, 5, 11, 12, 13, 33, -1};
+
+/**
+ * Return whether index i is in list, which ends with -1.
+ */
+static int option_in(const int *list, int i) {
+	for (; *list >= 0 && *list != i; list++);
+	return *list >= 0;
+}
+
+/**
+ * Fill pathvalues with the configuration values of path name: the ones given
+ * as name.option, or else the ones given outside any path. Returns 0 on
+ * success or -1 on error.
+ */
+int get_path_values(char *fname, char **confoptions, char **confvalues, char *name, char **pathvalues) {
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
+		memset(pathvalues[i], 0, 80);
+	}
+	if (parse_conffile_section(fname, name, confoptions, pathvalues, NUM_CONFOPTIONS) < 0) {
+		fprintf(stderr, "Error: Invalid, duplicate or too long configuration option for path %s\n", name);
+		return -1;
+	}
+
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
+		if (!option_in(path_options, i)) {
+			if (*pathvalues[i]) {
+				fprintf(stderr, "Error: Option %s cannot be set for path %s\n", confoptions[i], name);
+				ret = -1;
+			}
+		}
+		else if (!*pathvalues[i]) {
+			if (i == 10) {
+				snprintf(pathvalues[i], 80, "%s.%s", *confvalues[i] ? confvalues[i] : DEF_OUTFILE, name);
+			}
+			else if (i == 23 && *confvalues[i]) {
+				snprintf(pathvalues[i], 80, "%s.%s", confvalues[i], name);
+			}
+			else {
+				strcpy(pathvalues[i], confvalues[i]);
+			}
+		}
+	}
+	return ret;
+}
+
+/**
+ * Set up the paths listed in the paths option (confvalues[20]). Options of a
+ * path are given as name.option in the configuration file; options not given
+ * for a path are the ones given outside any path, except for the output
+ * file, which defaults to outfile.name. Returns 0 on success or -1 on error.
+ */
+int load_paths(char *fname, char **confoptions, char **confvalues) {
+	char *pathvalues[NUM_CONFOPTIONS];
+	char *name;
+	char *saveptr;
+	int ret = 0;
+	int i, j;
+
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
+		pathvalues[i] = (char*)malloc(80);
+	}
+
+	npaths = 0;
+	for (name = strtok_r(confvalues[20], ", \t", &saveptr); name && !ret; name = strtok_r(NULL, ", \t", &saveptr)) {
+		if (npaths == LES_MAXPATHS) {
+			fprintf(stderr, "Error: Too many paths (max %d)\n", LES_MAXPATHS);
+			ret = -1;
+			break;
+		}
+		if (strlen(name) >= LES_PATHNAMELEN || strchr(name, '.') || !strcmp(name, PATH_ALL) || find_path(name) >= 0) {
+			fprintf(stderr, "Error: Invalid path name %s\n", name);
+			ret = -1;
+			break;
+		}
+
+		if (get_path_values(fname, confoptions, confvalues, name, pathvalues) < 0) {
+			ret = -1;
+			break;
+		}
+
+		j = npaths++;
+		strcpy(paths[j].name, name);
+		load_path_params(pathvalues, &paths[j].params);
+	}
+
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
+		free(pathvalues[i]);
+	}
+	if (!ret && !npaths) {
+		fprintf(stderr, "Error: No paths given\n");
+		ret = -1;
+	}
+	return ret;
+}
+
+/**
+ * Free the fit function interpolation table of a parameter block.
+ */
+void free_path_params(struct les_params_t *params) {
+	fittable_free(&params->table);
+}
+
+/**
+ * Report an option whose new value is ignored until LES is restarted.
+ */
+static void report_restart(char *path, char *option, int tosyslog) {
+	char message[160];
+
+	snprintf(message, sizeof(message), "Warning: les: reload: %s%s%s changed, restart required", path ? path : "",
+		path ? "." : "", option);
+	log_message(LOG_WARNING, message, tosyslog);
+}
+
+/**
+ * Report the options of a path that changed in p and cannot change while
+ * running.
+ */
+static void check_path_restart(struct les_path_t *path, struct les_params_t *p, int tosyslog) {
+	struct les_params_t *cur = &path->params;
+	char *name = npaths > 1 ? path->name : NULL;
+
+	if (strcmp(cur->devname, p->devname)) report_restart(name, "ttydev", tosyslog);
+	if (cur->devspeed != p->devspeed) report_restart(name, "ttyspeed", tosyslog);
+	if (strcmp(cur->logfile, p->logfile)) report_restart(name, "outfile", tosyslog);
+	if (cur->logflush != p->logflush) report_restart(name, "logflush", tosyslog);
+	if (cur->logflushbytes != p->logflushbytes) report_restart(name, "logflushbytes", tosyslog);
+	if (strcmp(cur->archive, p->archive)) report_restart(name, "archive", tosyslog);
+	if (cur->logrotatesize != p->logrotatesize) report_restart(name, "logrotatesize", tosyslog);
+	if (cur->logrotateinterval != p->logrotateinterval) report_restart(name, "logrotateinterval", tosyslog);
+	if (cur->logkeep != p->logkeep) report_restart(name, "logkeep", tosyslog);
+	if (cur->logcompress != p->logcompress) report_restart(name, "logcompress", tosyslog);
+	if (cur->pctwindow != p->pctwindow) report_restart(name, "pctwindow", tosyslog);
+	if (strcmp(cur->replay, p->replay)) report_restart(name, "replay", tosyslog);
+	if (cur->replayspeed != p->replayspeed) report_restart(name, "replayspeed", tosyslog);
+	if (cur->replayrepeat != p->replayrepeat) report_restart(name, "replayrepeat", tosyslog);
+}
+
+/**
+ * Re-read the configuration file and hand the new estimator parameters of
+ * each path to its device thread. Options that cannot change while running
+ * are reported, and keep their values. Messages go to syslog if tosyslog is
+ * set. Returns the number of paths updated, or -1 if the file is invalid.
+ */
+int reload_config(int tosyslog) {
+	struct les_params_t *params[LES_MAXPATHS];
+	struct les_params_t *old;
+	char *confvalues[NUM_CONFOPTIONS];
+	char *pathvalues[NUM_CONFOPTIONS];
+	char **values = npaths > 1 ? pathvalues : confvalues;
+	char message[384];
+	int ret = 0;
+	int i;
+
+	memset(params, 0, sizeof(params));
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
+		confvalues[i] = (char*)calloc(1, 80);
+		pathvalues[i] = (char*)calloc(1, 80);
+	}
+
+	/* build and validate the parameters of all paths before handing any out */
+	if (parse_conffile(conf_file, conf_options, confvalues, NUM_CONFOPTIONS) < 0) {
+		snprintf(message, sizeof(message), "Error: les: reload: could not parse %.255s", conf_file);
+		log_message(LOG_ERR, message, tosyslog);
+		ret = -1;
+	}
+	for (i = 0; i < npaths && !ret; i++) {
+		if (npaths > 1 && get_path_values(conf_file, conf_options, confvalues, paths[i].name, pathvalues) < 0) {
+			snprintf(message, sizeof(message), "Error: les: reload: invalid options for path %.*s", LES_PATHNAMELEN, paths[i].name);
+			log_message(LOG_ERR, message, tosyslog);
+			ret = -1;
+			break;
+		}
+		params[i] = (struct les_params_t*)calloc(1, sizeof(struct les_params_t));
+		if (!params[i]) {
+			ret = -1;
+			break;
+		}
+		load_path_params(values, params[i]);
+		/* unlike at startup, an invalid fit function is not replaced by the default */
+		if (*values[2] && strcmp(params[i]->fitfunc, values[2])) {
+			snprintf(message, sizeof(message), "Error: les: reload: invalid fit function for path %.*s", LES_PATHNAMELEN, paths[i].name);
+			log_message(LOG_ERR, message, tosyslog);
+			ret = -1;
+		}
+		else if (params[i]->w < 0 || params[i]->w > 1) {
+			snprintf(message, sizeof(message), "Error: les: reload: w out of [0, 1] for path %.*s", LES_PATHNAMELEN, paths[i].name);
+			log_message(LOG_ERR, message, tosyslog);
+			ret = -1;
+		}
+	}
+
+	if (!ret) {
+		/* options of paths are compared once parsed, below */
+		for (i = 0; i < NUM_CONFOPTIONS; i++) {
+			if (!option_in(reload_options, i) && !option_in(path_options, i) && strcmp(confvalues[i], conf_values[i])) {
+				report_restart(NULL, conf_options[i], tosyslog);
+			}
+		}
+		for (i = 0; i < npaths; i++) {
+			check_path_restart(&paths[i], params[i], tosyslog);
+			/* a block the device thread has not picked up yet is replaced */
+			old = __atomic_exchange_n(&paths[i].reload, params[i], __ATOMIC_ACQ_REL);
+			if (old) {
+				free_path_params(old);
+				free(old);
+			}
+			params[i] = NULL;
+		}
+		strncpy(trace_file, *confvalues[33] ? confvalues[33] : DEF_TRACEFILE, 255);
+		snprintf(message, sizeof(message), "les: reload: configuration of %d path(s) reloaded from %.255s", npaths, conf_file);
+		log_message(LOG_INFO, message, tosyslog);
+		ret = npaths;
+	}
+
+	for (i = 0; i < npaths; i++) {
+		if (params[i]) {
+			free_path_params(params[i]);
+			free(params[i]);
+		}
+	}
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
+		free(confvalues[i]);
+		free(pathvalues[i]);
+	}
+	return ret;
+}
+
+/**
+ * Switch to the parameters reloaded for a path, if any, carrying over the
+ * estimator state. Called by the device thread of the path only.
+ */
+void apply_reload(struct les_path_t *path) {
+	struct les_params_t *params = &path->params;
+	struct les_params_t *p;
+
+	p = __atomic_exchange_n(&path->reload, NULL, __ATOMIC_ACQUIRE);
+	if (!p) {
+		return;
+	}
+
+	/* the window keeps its most recent samples; the EWMA goes on as is */
+	if (p->winsize != params->winsize && window_resize(&path->window, p->winsize) < 0) {
+		fprintf(stderr, "Warning: path %s: could not resize the sample window\n", path->name);
+		p->winsize = params->winsize;
+	}
+	strcpy(params->fitfunc, p->fitfunc);
+	params->fitcode = p->fitcode;
+	free_path_params(params);
+	params->table = p->table;
+	params->table.func = &params->fitcode;
+	params->fittable = p->fittable;
+	params->fiterr = p->fiterr;
+	params->w = p->w;
+	params->winsize = p->winsize;
+	params->Dlow = p->Dlow;
+	params->skipsync = p->skipsync;
+	free(p);
 }
 
 int main(int argc, char **argv) {
 	int ret;
-	int mtype;
-	char *message;
-	int clen;
 	int i;
-	int perr;
-	struct load_info_t *linfo;
+	struct cnx_info_t tcpinfo;
+	struct cnx_info_t udpinfo;
+	struct udp_pool_t udp_pool;
+	int idle_timeout;
+	int udp_workers;
+	int udp_batch;
 
 	/***********************************************************/
 	/* Configuration */
 	/***********************************************************/
 	int is_daemon;
 	char lockfile[80];
-	struct les_params_t params;
 	struct cnx_info_t info;
 	char *checkptr;
 
-	memset(&params, 0, sizeof(struct les_params_t));
 	memset(&info, 0, sizeof(struct cnx_info_t));
 
 	char **confvalues;
@@ -295,6 +1210,28 @@ int main(int argc, char **argv) {
 		"lockfile",
 		"outfile",
 		"skipsync",
+		"fittable",
+		"fiterr",
+		"idletimeout",
+		"udpworkers",
+		"udpbatch",
+		"mcastgroup",
+		"mcastport",
+		"mcastttl",
+		"paths",
+		"logflush",
+		"logflushbytes",
+		"archive",
+		"logrotatesize",
+		"logrotateinterval",
+		"logkeep",
+		"logcompress",
+		"pctwindow",
+		"replay",
+		"replayspeed",
+		"replayrepeat",
+		"metricsport",
+		"tracefile",
 		NULL
 	};
 
@@ -304,12 +1241,12 @@ int main(int argc, char **argv) {
 	}
 
 	/* read configuration */
-	confvalues = (char **)malloc(12 * sizeof(char*));
-	for (i = 0; i < 12; i++) {
+	confvalues = (char **)malloc(NUM_CONFOPTIONS * sizeof(char*));
+	for (i = 0; i < NUM_CONFOPTIONS; i++) {
 		confvalues[i] = (char*)malloc(80);
 		memset(confvalues[i], 0, 80);
 	}
-	ret = parse_conffile(argv[1], (char**)confoptions, confvalues, 12);
+	ret = parse_conffile(argv[1], (char**)confoptions, confvalues, NUM_CONFOPTIONS);
 	if (ret == -1) {
 		fprintf(stderr, "Error: Could not open configuration file\n");
 		exit(1);
@@ -325,68 +1262,16 @@ int main(int argc, char **argv) {
 		exit(1);
 	}
 
-	/* tty device */
-	if (!*confvalues[0]) {
-		strncpy(params.devname, DEF_TTYDEV, 80);
-	}
-	else {
-		strncpy(params.devname, confvalues[0], 80);
-	}
-
-	/* device speed */
-	if (!*confvalues[1]) {
-		if (!strncasecmp(confvalues[1], "115200", 6)) {
-			params.devspeed = B115200;
-		}
-		else if (!strncasecmp(confvalues[1], "9600", 6)) {
-			params.devspeed = B9600;
-		}
-		else if (!strncasecmp(confvalues[1], "38400", 6)) {
-			params.devspeed = B38400;
-		}
-		else {
-			/* default */
-			params.devspeed = DEF_TTYSPEED;
-		}
-	}
-	else {
-		params.devspeed = DEF_TTYSPEED;
-	}
-
-	/* fit function */
-	if (!*confvalues[2]) {
-		strcpy(params.fitfunc, DEF_FITFUNC);
-	}
-	else {
-		strcpy(params.fitfunc, confvalues[2]);
-		/* Test if the given func is syntactically correct. If not, silently go back to default */
-		map_to_load(params.fitfunc, 1.0, &perr);
-		if (perr) {
-			memset(params.fitfunc, 0, 128);
-			strcpy(params.fitfunc, DEF_FITFUNC);
-		}
-	}
-
-	/* smoothing factor */
-	params.w = strtod(confvalues[3], &checkptr);
-	if (*checkptr != '\0') {
-		params.w = DEF_W;
-	}
-
-	/* window size */
-	params.winsize = strtol(confvalues[4], &checkptr, 10);
-	if (*checkptr != '\0') {
-		params.winsize = DEF_WINSIZE;
-	}
-
-	/* low load threshold (in nanosec) */
-	params.Dlow = strtod(confvalues[5], &checkptr);
-	if (*checkptr != '\0') {
-		params.Dlow = DEF_DLOW;
+	if (ret == -4) {
+		fprintf(stderr, "Error: Configuration option or value too long (max %d characters)\n", CONF_MAXLEN);
+		exit(1);
 	}
 
 	/* protocol (see netfunc.h) */
-	if (!strncmp(confvalues[6], "TCP", 3)) {
+	if (!strncmp(confvalues[6], "BOTH", 4)) {
+		info.proto = _PROTO_BOTH_;
+	}
+	else if (!strncmp(confvalues[6], "TCP", 3)) {
 		info.proto = _PROTO_TCP_;
 	}
 	else if (!strncmp(confvalues[6], "UDP", 3)) {
@@ -427,37 +1312,84 @@ int main(int argc, char **argv) {
 		strncpy(lockfile, confvalues[9], 80);
 	}
 
-	/* output file */
-	if (!*confvalues[10]) {
-		strncpy(params.logfile, DEF_OUTFILE, 80);
+	/* idle TCP connection timeout (msec) */
+	idle_timeout = strtol(confvalues[14], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[14] || idle_timeout < 0) {
+		idle_timeout = DEF_IDLETIMEOUT;
+	}
+
+	/* UDP worker threads */
+	udp_workers = strtol(confvalues[15], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[15] || udp_workers < 0 || udp_workers > UDPPOOL_MAXWORKERS) {
+		udp_workers = DEF_UDPWORKERS;
+	}
+
+	/* max UDP requests per receive call */
+	udp_batch = strtol(confvalues[16], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[16] || udp_batch < 1 || udp_batch > UDPPOOL_MAXBATCH) {
+		udp_batch = DEF_UDPBATCH;
+	}
+
+	/* local port of the metrics endpoint */
+	metrics_port = strtol(confvalues[32], &checkptr, 10);
+	if (*checkptr != '\0' || metrics_port < 0 || metrics_port > 65535) {
+		metrics_port = DEF_METRICSPORT;
+	}
+
+	/* file the pipeline traces are dumped to */
+	if (!*confvalues[33]) {
+		strncpy(trace_file, DEF_TRACEFILE, 255);
 	}
 	else {
-		strncpy(params.logfile, confvalues[10], 80);
+		strncpy(trace_file, confvalues[33], 255);
 	}
 
-	/* ignore sync messages in load estimation */
-	params.skipsync = strtol(confvalues[11], &checkptr, 10);
-	if (*checkptr != '\0' || (params.skipsync != 0 && params.skipsync != 1) ) {
-		/* maybe value is given as yes/y/no/n */
-		if (!strncasecmp(confvalues[11], "y", 1)) {
-			params.skipsync = 1;
-		}
-		else 
-		if (!strncasecmp(confvalues[11], "n", 1)) {
-			params.skipsync = 0;
-		}
-		else {
-			params.skipsync = DEF_SKIPSYNC;
+	/* multicast group for load updates */
+	memset(&mcast, 0, sizeof(struct cnx_info_t));
+	if (!*confvalues[17]) {
+		strncpy(mcast.host, DEF_MCASTGROUP, 80);
+	}
+	else {
+		strncpy(mcast.host, confvalues[17], 80);
+	}
+
+	/* multicast port (default: server port + MCAST_PORT_OFFSET) */
+	mcast.port = strtol(confvalues[18], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[18]) {
+		mcast.port = info.port + MCAST_PORT_OFFSET;
+	}
+
+	/* multicast TTL */
+	mcast_ttl = strtol(confvalues[19], &checkptr, 10);
+	if (*checkptr != '\0' || !*confvalues[19] || mcast_ttl < 0 || mcast_ttl > 255) {
+		mcast_ttl = DEF_MCASTTTL;
+	}
+
+	if (*mcast.host) {
+		if (init_multicast_sender(&mcast, mcast_ttl) < 0) {
+			fprintf(stderr, "Error: Invalid multicast group %s\n", mcast.host);
+			exit(1);
 		}
+		mcast_enabled = 1;
+	}
+
+	/* monitored paths: one per device, each with its own estimator */
+	if (!*confvalues[20]) {
+		npaths = 1;
+		strcpy(paths[0].name, "default");
+		load_path_params(confvalues, &paths[0].params);
+	}
+	else if (load_paths(argv[1], confoptions, confvalues) < 0) {
+		exit(1);
 	}
 
 	/* show configuration */
-	print_config(&params, &info, is_daemon, lockfile);
+	print_config(&info, is_daemon, lockfile, idle_timeout, udp_workers, udp_batch);
 
-	for (i = 0; i < 12; i++) {
-		free(confvalues[i]);
-	}
-	free(confvalues);
+	/* kept to tell which options change on reload */
+	conf_file = argv[1];
+	conf_options = confoptions;
+	conf_values = confvalues;
 
 	/* endof configuration options */
 	/******************************************************/
@@ -472,23 +1404,70 @@ int main(int argc, char **argv) {
 		signal(SIGTERM, term_handler);
 		signal(SIGKILL, term_handler);
 		signal(SIGINT, term_handler);
-		signal(SIGHUP, term_handler);
+		signal(SIGHUP, hup_handler);
+		signal(SIGUSR1, usr1_handler);
 	}
 
 	/* mutices */
 	pthread_mutex_init(&mtx_running, NULL);
-	pthread_mutex_init(&mtx_delay_info, NULL);
 
-	/* sample window */
-	window = NULL;
+	for (i = 0; i < npaths; i++) {
+		/* sample window */
+		paths[i].delay_stats.path = i;
+		if (window_init(&paths[i].window, paths[i].params.winsize) < 0) {
+			fprintf(stderr, "Error: Could not allocate sample window\n");
+			exit(1);
+		}
+		qwindow_init(&paths[i].delay_window, paths[i].params.pctwindow);
+
+		/* initial (empty) load information */
+		publish_load_info(&paths[i]);
+	}
+
+	/* internal counters, served on a local port */
+	register_metrics();
+	if (metrics_port && metrics_start(metrics_port) < 0) {
+		fprintf(stderr, "Warning: could not serve metrics on port %d\n", metrics_port);
+	}
 
-	/* threads */
-	pthread_t delay_thread;
-	pthread_create(&delay_thread, NULL, (void*)&tfunc_delay_monitor, (void*)&params);
+	/* threads: one per device */
+	for (i = 0; i < npaths; i++) {
+		if (*paths[i].params.replay) nreplays++;
+	}
+	replays_running = nreplays;
+	for (i = 0; i < npaths; i++) {
+		pthread_create(&paths[i].thread, NULL, (void*)&tfunc_delay_monitor, (void*)&paths[i]);
+	}
 
-	/* networking */
+	/* networking: serve TCP and/or UDP clients from a single reactor, or
+	 * UDP clients from a pool of worker threads */
 	memcpy(info.host, "0.0.0.0\0", 8); /* any addr */
-	if (init_server(&info) < 0) {
+	if (info.proto & _PROTO_TCP_) {
+		memcpy(&tcpinfo, &info, sizeof(struct cnx_info_t));
+		tcpinfo.proto = _PROTO_TCP_;
+		if (init_server(&tcpinfo) < 0) {
+			fprintf(stderr, "Init failed");
+			exit(1);
+		}
+	}
+	if (info.proto & _PROTO_UDP_) {
+		memcpy(&udpinfo, &info, sizeof(struct cnx_info_t));
+		udpinfo.proto = _PROTO_UDP_;
+		if (udp_workers) {
+			if (udp_pool_start(&udp_pool, &udpinfo, udp_workers, udp_batch, handle_request) < 0) {
+				fprintf(stderr, "Init failed");
+				exit(1);
+			}
+		}
+		else if (init_server(&udpinfo) < 0) {
+			fprintf(stderr, "Init failed");
+			exit(1);
+		}
+	}
+	if (reactor_init(&reactor,
+			(info.proto & _PROTO_TCP_) ? &tcpinfo : NULL,
+			((info.proto & _PROTO_UDP_) && !udp_workers) ? &udpinfo : NULL,
+			idle_timeout, handle_request, push_load_update) < 0) {
 		fprintf(stderr, "Init failed");
 		exit(1);
 	}
@@ -500,47 +1479,43 @@ int main(int argc, char **argv) {
 		pthread_mutex_unlock(&mtx_running);
 		if (stopval) break;
 
-		struct cnx_info_t clicnx;
-
-		/* either apply an iterative TCP server, or work on top of UDP */
-		if (info.proto == _PROTO_TCP_) {
-			/* accept */
-			struct cnx_info_t* cinfo = accept_client_connection(&info);
-			memcpy(&clicnx, cinfo, sizeof(struct cnx_info_t));
-			free(cinfo);
+		/* wake up every second to check if we should stop */
+		if (reactor_poll(&reactor, 1000) < 0) {
+			log_message(LOG_ERR, "Error: les: Could not wait for network events", is_daemon);
+			break;
 		}
-		else {
-			/* Operation over UDP, use the original "info" struct */
-			memcpy(&clicnx, &info, sizeof(struct cnx_info_t));
+		if (trace_dump_requested) {
+			trace_dump_requested = 0;
+			dump_pipetraces(is_daemon);
 		}
-
-		/* read a protocol message */
-		/* TODO: check timeout! */
-		message = recv_protocol_message(&clicnx, &mtype, 0, FROM_CLIENT);
-
-		/* check message type and respond */
-		if (mtype == MTYPE_LREQ) {
-			if (message) free(message);
-			linfo = get_load_info();
-			message = generate_load_response(linfo);
-			free(linfo);
-
-			/* send load response */
-			xmit_protocol_message(&clicnx, (void *)message, TO_CLIENT);
-			if (message) free(message);
+		if (reload_requested) {
+			reload_requested = 0;
+			reload_config(is_daemon);
 		}
 	} while (1);
 
+	/* device threads notify the reactor, so they are joined first */
+	for (i = 0; i < npaths; i++) {
+		pthread_join(paths[i].thread, NULL);
+	}
+	reactor_close(&reactor);
+	if ((info.proto & _PROTO_UDP_) && udp_workers) {
+		udp_pool_stop(&udp_pool);
+	}
+
 	return 0;
 }
 
 /**
  * Output configuration settings.
  */
-void print_config(struct les_params_t* lp, struct cnx_info_t *cnx, int daemon, char *lockfile) {
+void print_config(struct cnx_info_t *cnx, int daemon, char *lockfile, int idle_timeout, int udp_workers, int udp_batch) {
 	fprintf(stderr, "Application configuration:\n");	
 	fprintf(stderr, "--------------------------\n");
-	if (cnx->proto == _PROTO_TCP_) {
+	if (cnx->proto == _PROTO_BOTH_) {
+		fprintf(stderr, "Protocol: TCP and UDP\n");
+	}
+	else if (cnx->proto == _PROTO_TCP_) {
 		fprintf(stderr, "Protocol: TCP\n");
 	}
 	else if (cnx->proto == _PROTO_UDP_) {
@@ -549,26 +1524,65 @@ void print_config(struct les_params_t* lp, struct cnx_info_t *cnx, int daemon, c
 	else {
 		fprintf(stderr, "Protocol: Unknown\n");
 	}
-	fprintf(stderr, "Port: %d\nDaemon: %d\nLockfile: %s\nOutput file: %s\n", cnx->port, daemon, lockfile, lp->logfile);
+	fprintf(stderr, "Port: %d\nIdle connection timeout: %d msec\n", cnx->port, idle_timeout);
+	if ((cnx->proto & _PROTO_UDP_) && udp_workers) {
+		fprintf(stderr, "UDP workers: %d (batch: %d)\n", udp_workers, udp_batch);
+	}
+	if (mcast_enabled) {
+		fprintf(stderr, "Multicast: %s:%d (TTL: %d)\n", mcast.host, mcast.port, mcast_ttl);
+	}
+	if (metrics_port) {
+		fprintf(stderr, "Metrics: http://127.0.0.1:%d/metrics\n", metrics_port);
+	}
+	fprintf(stderr, "Pipeline traces: %s (SIGUSR1)\n", trace_file);
+	fprintf(stderr, "Daemon: %d\nLockfile: %s\n", daemon, lockfile);
 
-	fprintf(stderr, "\nDevice configuration:\n");	
-	fprintf(stderr, "--------------------------\n");
+	struct les_params_t *lp;
 	int speed;
-	switch (lp->devspeed) {
-		case B115200:
-			speed = 115200;
-			break;
-		case B9600:
-			speed = 9600;
-		case B38400:
-			speed = 38400;
-		default:
-			speed = -1;
-	}
-	fprintf(stderr, "Name: %s\nSpeed: %d\n", lp->devname, speed);
+	int i;
+	for (i = 0; i < npaths; i++) {
+		lp = &paths[i].params;
+		fprintf(stderr, "\nPath: %s\nOutput file: %s (flushed every %d msec or %d bytes)\n", paths[i].name, lp->logfile, lp->logflush, lp->logflushbytes);
+		if (lp->logrotatesize || lp->logrotateinterval) {
+			fprintf(stderr, "Rotation: every %lld bytes or %d sec (0: never), keep %d%s\n", lp->logrotatesize, lp->logrotateinterval,
+				lp->logkeep, lp->logcompress ? ", compressed" : "");
+		}
+		fprintf(stderr, "Delay percentiles window: %d sec\n", lp->pctwindow);
+		if (*lp->archive) {
+			fprintf(stderr, "Archive: %s\n", lp->archive);
+		}
+		fprintf(stderr, "\nDevice configuration:\n");	
+		fprintf(stderr, "--------------------------\n");
+		switch (lp->devspeed) {
+			case B115200:
+				speed = 115200;
+				break;
+			case B9600:
+				speed = 9600;
+			case B38400:
+				speed = 38400;
+			default:
+				speed = -1;
+		}
+		if (*lp->replay) {
+			fprintf(stderr, "Trace: %s (speed-up: %g, 0: max, passes: %d)\n", lp->replay, lp->replayspeed, lp->replayrepeat);
+		}
+		else {
+			fprintf(stderr, "Name: %s\nSpeed: %d\n", lp->devname, speed);
+		}
 
-	fprintf(stderr, "\nLoad estimation algorithm:\n");
-	fprintf(stderr, "Fit function: %s\nSmoothing factor (w): %lf\nSample window size: %d\nLow load threshold: %lf\nSkip SYNC: %d\n", lp->fitfunc, lp->w, lp->winsize, lp->Dlow, lp->skipsync);
+		fprintf(stderr, "\nLoad estimation algorithm:\n");
+		fprintf(stderr, "Fit function: %s (%d operations)\nSmoothing factor (w): %lf\nSample window size: %d\nLow load threshold: %lf\nSkip SYNC: %d\n", lp->fitfunc, lp->fitcode.nnodes, lp->w, lp->winsize, lp->Dlow, lp->skipsync);
+		if (lp->table.npoints) {
+			fprintf(stderr, "Fit table: %d points over [%lf, %lf], max error: %g (estimated)\n", lp->table.npoints, lp->table.x[0], lp->table.x[lp->table.npoints - 1], lp->table.maxerr);
+		}
+		else if (lp->fittable && lp->table.maxerr > 0) {
+			fprintf(stderr, "Warning: fit table: %d points reach an error of %g, above fiterr (%g); using fit function\n", lp->fittable, lp->table.maxerr, lp->fiterr);
+		}
+		else if (lp->fittable) {
+			fprintf(stderr, "Fit table: could not be built, using fit function\n");
+		}
+	}
 	fprintf(stderr, "--------------------------\n\n");
 }
 
@@ -27,7 +27,17 @@
 #include "protocol.h"
 #include "ptpdevice.h"
 #include "window.h"
+#include "estimator.h"
 #include "conffile.h"
+#include "funceval.h"
+#include "fittable.h"
+#include "seqlock.h"
+#include "samplelog.h"
+#include "history.h"
+#include "qsketch.h"
+#include "replay.h"
+#include "metrics.h"
+#include "pipetrace.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -54,13 +64,58 @@
 #define DEF_LOCKFILE	"les.lock"
 #define DEF_DAEMON		0
 #define DEF_SKIPSYNC	0
+#define DEF_FITTABLE	0 /* no interpolation table */
+#define DEF_FITERR		0.001
+#define DEF_IDLETIMEOUT	30000 /* msec */
+#define DEF_UDPWORKERS	0 /* UDP served by the reactor */
+#define DEF_UDPBATCH	32
+#define DEF_MCASTGROUP	"" /* no multicast publication */
+#define DEF_MCASTTTL	1
+#define DEF_PATHS		"" /* single device */
+#define DEF_LOGFLUSH	1000 /* msec */
+#define DEF_LOGFLUSHBYTES	4096
+#define DEF_ARCHIVE		"" /* no archive */
+#define DEF_LOGROTATESIZE	0 /* never */
+#define DEF_LOGROTATEINTERVAL	0 /* never */
+#define DEF_LOGKEEP		10
+#define DEF_LOGCOMPRESS	1
+#define DEF_PCTWINDOW	60 /* sec */
+#define DEF_REPLAY		"" /* read the device */
+#define DEF_REPLAYSPEED	0.0 /* as fast as possible */
+#define DEF_REPLAYREPEAT	1
+#define DEF_METRICSPORT	0 /* no metrics endpoint */
+#define DEF_TRACEFILE	"les-trace.txt"
+
+/* length of path names (see LES_MAXPATHS in protocol.h) */
+#define LES_PATHNAMELEN	32
+
+/* a reply for all paths must fit in a reactor reply */
+#if LES_MAXPATHS * LRSP_MAXLEN > REACTOR_REPLYLEN
+#error "LES_MAXPATHS too large for REACTOR_REPLYLEN"
+#endif
+
+/* number of configuration options */
+#define NUM_CONFOPTIONS	34
 
-pthread_mutex_t mtx_delay_info;
 pthread_mutex_t mtx_running;
 int stop = 0;
 
-struct load_info_t delay_stats;
-struct window_t *window;
+/* serves TCP (and UDP) clients; pushes updates to subscribers */
+struct reactor_t reactor;
+/* multicast publication of load updates */
+int mcast_enabled = 0;
+int mcast_ttl;
+struct cnx_info_t mcast;
+/* local port of the metrics endpoint (0: none) */
+int metrics_port;
+/* file the pipeline traces are dumped to (SIGUSR1) */
+char trace_file[256];
+volatile sig_atomic_t trace_dump_requested = 0;
+/* configuration file, and the options and values it was started with */
+char *conf_file;
+char **conf_options;
+char **conf_values;
+volatile sig_atomic_t reload_requested = 0;
 
 /**
  * Parameters for the load estimation algorithm
@@ -68,6 +123,14 @@ struct window_t *window;
 struct les_params_t {
 	/* fit function */
 	char fitfunc[256];
+	/* compiled fit function */
+	struct fitfunc_t fitcode;
+	/* max interpolation table points (0: evaluate fit function) */
+	int fittable;
+	/* max interpolation error */
+	double fiterr;
+	/* interpolation table */
+	struct fittable_t table;
 	/* smoothing factor */
 	double w;
 	/* window size */
@@ -82,36 +145,259 @@ struct les_params_t {
 	int devspeed;
 	/* output file */
 	char logfile[256];
+	/* write samples out every logflush msec or logflushbytes bytes */
+	int logflush;
+	int logflushbytes;
+	/* binary sample archive (empty: none) */
+	char archive[256];
+	/* rotate the output file after this many bytes or seconds (0: never) */
+	long long logrotatesize;
+	int logrotateinterval;
+	/* rotated output files kept */
+	int logkeep;
+	/* compress rotated output files */
+	int logcompress;
+	/* horizon of the sliding delay percentiles (sec) */
+	int pctwindow;
+	/* trace replayed instead of reading the device (empty: none), its
+	 * speed-up factor (0: as fast as possible) and number of passes */
+	char replay[256];
+	double replayspeed;
+	int replayrepeat;
+};
+
+/**
+ * A network path monitored through a PTP device, with its own estimator.
+ */
+struct les_path_t {
+	char name[LES_PATHNAMELEN];
+	struct les_params_t params;
+	/* delay statistics and sample window, updated by the device thread only */
+	struct load_info_t delay_stats;
+	struct window_t window;
+	/* delay quantile sketches, over the lifetime and the last pctwindow sec */
+	struct qsketch_t delay_sketch;
+	struct qwindow_t delay_window;
+	/* copy of delay_stats published to request handlers */
+	struct load_info_t snapshot;
+	/* LRSP messages for snapshot, rendered once per update */
+	char response[LRSP_MAXLEN];
+	int response_len;
+	char response_bin[LBRSP_LEN];
+	struct seqlock_t seqlock;
+	/* device thread */
+	pthread_t thread;
+	struct termios old_term;
+	/* sample output file, written by its own thread */
+	struct samplelog_t samplelog;
+	/* splits device input into records */
+	struct dev_reader_t reader;
+	/* lines dropped by the device thread, per ptp_parse_line() reason */
+	unsigned int bad_lines[PTP_NUM_REASONS];
+	/* counters of the device thread (see metrics.h) */
+	unsigned int lines;
+	unsigned int sync_skipped;
+	unsigned int ignored;
+	unsigned int fit_errors;
+	/* load history served to HREQ */
+	struct history_t history;
+	/* stage times of the last lines through the device thread */
+	struct pipetrace_t pipetrace;
+	/* parameters reloaded from the configuration file, picked up by the
+	 * device thread on its next line */
+	struct les_params_t *reload;
+};
+
+/* monitored paths; a single one unless the paths option is set */
+struct les_path_t paths[LES_MAXPATHS];
+int npaths = 0;
+/* requests served per type (per-thread counters), and their handling time
+ * (per-thread histogram REQ_LATENCY) */
+#define REQ_LREQ		0
+#define REQ_LBREQ		1
+#define REQ_SUBS		2
+#define REQ_HREQ		3
+#define REQ_INVALID		4
+#define NUM_REQTYPES	5
+#define REQ_LATENCY		0
+
+/* paths replaying a trace, and those still running */
+int nreplays = 0;
+int replays_running = 0;
+
+/**
+ * Update running load estimate of a path based on the new delay sample
+ * received. Called by the device thread of the path only.
+ */
+double estimate_load(struct les_path_t *path, long long sample);
+
+/**
+ * Publish the delay statistics of a path to request handlers, along with the
+ * LRSP messages that report them, and multicast the binary LRSP message if
+ * enabled.
+ */
+void publish_load_info(struct les_path_t *path);
+
+/**
+ * Copy current load information of a path to linfo. Never blocks the device
+ * thread.
+ */
+void get_load_info(struct les_path_t *path, struct load_info_t *linfo);
+
+/**
+ * Copy the current LRSP message of a path to buf (at least LRSP_MAXLEN bytes)
+ * and return its length. The binary variant is copied if mtype is
+ * MTYPE_LBREQ. Never blocks the device thread.
+ */
+int get_load_response(struct les_path_t *path, int mtype, char *buf);
+
+/**
+ * Return the index of the path with the given name (the first path if name
+ * is empty) or -1 if there is no such path.
+ */
+int find_path(char *name);
+
+/**
+ * Answer an HREQ message of len bytes: render an HRSP message with the
+ * history of the requested path to reply and return its length.
+ */
+int get_history_response(char *data, int len, char *reply);
+
+/**
+ * Serve a request received by the reactor (see msg_handler_t in netfunc.h),
+ * counting it and its handling time.
+ */
+int handle_request(char *data, int len, char *reply, int *replylen, struct subscription_t *sub);
+
+/**
+ * Serve a request (see handle_request()), setting mtype to its type.
+ */
+int serve_request(char *data, int len, char *reply, int *replylen, struct subscription_t *sub, int *mtype);
+
+/**
+ * Register the counters of the service and its paths with the metrics
+ * registry.
+ */
+void register_metrics();
+
+/**
+ * Copy the current LRSP message of path index topic to reply for subscribers
+ * and set value to the current load (see push_handler_t in netfunc.h).
+ */
+int push_load_update(int topic, char *reply, double *value);
+
+/**
+ * State of the device thread of a path, carried across lines.
+ */
+struct line_state_t {
+	/* previous sample accepted */
+	struct ptp_sample_t last;
+	/* result of parsing the previous line */
+	int last_reason;
+	double load;
 };
 
 /**
- * Update running load estimate based on the new delay sample received.
+ * Return whether the service is stopping.
+ */
+int is_stopping();
+
+/**
+ * Parse a line read from the PTP device (or trace) of a path into cur,
+ * update the load estimate and log the sample. Returns the ptp_parse_line()
+ * result.
+ */
+int process_line(struct les_path_t *path, char *line, struct ptp_sample_t *cur, struct line_state_t *st);
+
+/**
+ * Process the lines of the PTP device of a path until the service stops or
+ * the device cannot be read.
+ */
+void read_device(struct les_path_t *path, int fd);
+
+/**
+ * Process the lines of a trace (replayspeed times faster than they were
+ * recorded according to T2, or as fast as possible if 0) replayrepeat
+ * times, then report the throughput.
+ */
+void read_trace(struct les_path_t *path, struct replay_t *trace);
+
+/**
+ * Thread which communicates with the PTP device of a path (or replays its
+ * trace) and maintains its delay statistics. Delay samples are also logged
+ * to a file. The path is passed in the arg argument, which is supposed to be
+ * a struct les_path_t*.
+ */
+void tfunc_delay_monitor(void *arg);
+
+/**
+ * Called when the trace of a path has been replayed. Once all paths are
+ * done, the service stops if no path reads a device.
+ */
+void replay_finished();
+
+/**
+ * Set up the estimator parameters of a path from the per-path configuration
+ * values. Invalid values fall back to defaults.
+ */
+void load_path_params(char **confvalues, struct les_params_t *params);
+
+/**
+ * Set up the paths listed in the paths option. Options of a path are given as
+ * name.option in the configuration file; options not given for a path are the
+ * ones given outside any path, except for the output file, which defaults to
+ * outfile.name. Returns 0 on success or -1 on error.
  */
-double estimate_load(struct les_params_t *params, struct window_t *window, long long sample);
+int load_paths(char *fname, char **confoptions, char **confvalues);
 
 /**
- * Log a delay sample and the current load estimate with a local timestamp
+ * Fill pathvalues with the configuration values of path name: the ones given
+ * as name.option, or else the ones given outside any path. Returns 0 on
+ * success or -1 on error.
  */
-void log_delay_sample(FILE *fp, long long sample, double load);
+int get_path_values(char *fname, char **confoptions, char **confvalues, char *name, char **pathvalues);
 
+/**
+ * Free the fit function interpolation table of a parameter block.
+ */
+void free_path_params(struct les_params_t *params);
 
 /**
- * Return current load information.
+ * Re-read the configuration file and hand the new estimator parameters of
+ * each path to its device thread. Options that cannot change while running
+ * are reported, and keep their values. Messages go to syslog if tosyslog is
+ * set. Returns the number of paths updated, or -1 if the file is invalid.
  */
-struct load_info_t *get_load_info();
+int reload_config(int tosyslog);
 
 /**
- * Thread which communicates with the PTP device and maintains delay statistics.
- * Delay samples are also logged to a file. Configuration options are passed
- * in the params argument, which is supposed to be a struct log_params_t*.
+ * Switch to the parameters reloaded for a path, if any, carrying over the
+ * estimator state. Called by the device thread of the path only.
  */
-void tfunc_delay_monitor(void *params);
+void apply_reload(struct les_path_t *path);
 
 /**
  * Termination signal handler.
  */
 void term_handler(int signal);
 
+/**
+ * Reopen the sample output files, e.g., after they have been rotated by an
+ * external tool, and reload the configuration file (SIGHUP).
+ */
+void hup_handler(int signal);
+
+/**
+ * Request a dump of the pipeline traces (SIGUSR1).
+ */
+void usr1_handler(int signal);
+
+/**
+ * Write the pipeline traces of all paths to the trace file, logging the
+ * outcome to syslog if tosyslog is set.
+ */
+void dump_pipetraces(int tosyslog);
+
 /**
  * Run as a daemon.
  */
@@ -125,14 +411,5 @@ void log_message(int type, char *message, int tosyslog);
 /**
  * Output configuration settings.
  */
-void print_config(struct les_params_t* lp, struct cnx_info_t *cnx, int daemon, char *lockfile);
-
-/**
- * Parses the expression of load as a function of delay and returns the result.
- * Function is supposed to be the string read from the configuration file, e.g.,
- * e^-(1.08X) +5*e^(2*X). The name of the variable is *strictly* X and will be
- * replaced by the value of the delay argument.
- */
-double map_to_load(char *func, double val, int *err);
+void print_config(struct cnx_info_t *cnx, int daemon, char *lockfile, int idle_timeout, int udp_workers, int udp_batch);
 #endif
-
@@ -0,0 +1,91 @@
+/**
+ * lesarc.c -- Convert a LES sample archive to text: the sample output file
+ * format (default) or the SecureSync line format the archive was read from.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "archive.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * Print a record as a line of the sample output file, unless it was not
+ * used for load estimation.
+ */
+void print_sample(struct archive_rec_t *rec) {
+	char str_sec[32];
+	struct tm ptm;
+	time_t sec = rec->rxtime / 1000000;
+
+	if (rec->flags & ARCHIVE_IGNORED) return;
+
+	localtime_r(&sec, &ptm);
+	strftime(str_sec, sizeof(str_sec), "%Y-%m-%d,%H:%M:%S", &ptm);
+	printf("%s.%03d\t%Ld\t%f\n", str_sec, (int)(rec->rxtime % 1000000 / 1000), (long long)rec->delay, rec->load);
+}
+
+/**
+ * Print a record as the SecureSync line it was read from. The day of the
+ * year and time (UTC) are those of T2.
+ */
+void print_securesync(struct archive_rec_t *rec) {
+	struct tm ptm;
+	time_t sec = rec->t2 / 1000000000;
+
+	gmtime_r(&sec, &ptm);
+	printf("%03d %02d:%02d:%02d.%03d %019Ld %019Ld %019Ld %019Ld\n", ptm.tm_yday + 1, ptm.tm_hour, ptm.tm_min, ptm.tm_sec,
+		(int)(rec->t2 % 1000000000 / 1000000), (long long)rec->t1, (long long)rec->t2, (long long)rec->t3, (long long)rec->t4);
+}
+
+int main(int argc, char **argv) {
+	struct archive_rec_t *recs;
+	size_t nrecs;
+	size_t i;
+	int securesync = 0;
+
+	if (argc == 3 && !strcmp(argv[1], "-s")) {
+		securesync = 1;
+	}
+	else if (argc != 2 && !(argc == 3 && !strcmp(argv[1], "-t"))) {
+		fprintf(stderr, "Usage: lesarc [-t | -s] archive\n"
+			"  -t: print samples in the sample output file format (default)\n"
+			"  -s: print all lines in the SecureSync format\n");
+		return 1;
+	}
+
+	recs = archive_map(argv[argc - 1], &nrecs);
+	if (!recs) {
+		fprintf(stderr, "Error: Could not read archive %s\n", argv[argc - 1]);
+		return 1;
+	}
+
+	for (i = 0; i < nrecs; i++) {
+		if (securesync) {
+			print_securesync(&recs[i]);
+		}
+		else {
+			print_sample(&recs[i]);
+		}
+	}
+
+	archive_unmap(recs, nrecs);
+	return 0;
+}
@@ -0,0 +1,281 @@
+/**
+ * leseval.c -- Parameter sweep of the load estimator over a trace labelled
+ * with the actual load. The trace is read once; every combination of window
+ * size, smoothing factor and low load threshold is then run through the
+ * estimator of the server (estimator.c) on all cores, and the mean squared
+ * error of each is reported along with the best one.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "estimator.h"
+#include "labelled.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#define EVAL_MAXTHREADS	256
+/* smoothing factors run in one pass over the instant loads; their
+ * recurrences are independent, so they overlap in the pipeline */
+#define EVAL_WBATCH		8
+
+/* default fit function, as in evaluation/les-eval.py */
+#define EVAL_FITFUNC	"0.8961*e^(4.656e-008*X)-1.954*e^(-8.066e-006*X)"
+
+/**
+ * Values swept for a parameter: from, from + step, ... up to to.
+ */
+struct range_t {
+	double *values;
+	int n;
+};
+
+/**
+ * Labelled trace and the sweep over it, shared by the worker threads.
+ */
+struct sweep_t {
+	struct labelled_t trace;
+	struct range_t winsize;
+	struct range_t w;
+	struct range_t dlow;
+	struct fitfunc_t fitcode;
+	int fittable;
+	double fiterr;
+	/* next (winsize, dlow) pair to run */
+	int next;
+	/* set if a worker ran out of memory */
+	int failed;
+	/* mean squared error, indexed by (winsize, dlow, w) */
+	double *mse;
+};
+
+/**
+ * Parse a range given as from[:to[:step]] (step defaults to defstep).
+ * Returns 0 on success or -1 if it is invalid.
+ */
+int parse_range(char *str, double defstep, struct range_t *r) {
+	double from, to, step = defstep;
+	char *p;
+	int i;
+
+	from = to = strtod(str, &p);
+	if (*p == ':') {
+		to = strtod(p + 1, &p);
+		if (*p == ':') {
+			step = strtod(p + 1, &p);
+		}
+	}
+	if (*p != '\0' || to < from || step <= 0) {
+		return -1;
+	}
+	r->n = (int)((to - from) / step + 1e-9) + 1;
+	r->values = (double*)malloc(r->n * sizeof(double));
+	if (!r->values) {
+		return -1;
+	}
+	for (i = 0; i < r->n; i++) {
+		r->values[i] = from + i * step;
+	}
+	return 0;
+}
+
+/**
+ * Worker thread: take (winsize, dlow) pairs until none is left. The instant
+ * loads depend on these two only, so they are computed once per pair and
+ * then smoothed with every w.
+ */
+void *sweep_worker(void *arg) {
+	struct sweep_t *sw = (struct sweep_t*)arg;
+	struct window_t window;
+	struct fittable_t table;
+	double *instant;
+	double load[EVAL_WBATCH];
+	double sum[EVAL_WBATCH];
+	double w[EVAL_WBATCH];
+	double err;
+	int fit_error;
+	int task;
+	int i, j, k, nw;
+
+	instant = (double*)malloc(sw->trace.n * sizeof(double));
+	if (!instant) {
+		sw->failed = 1;
+		return NULL;
+	}
+	while ((task = __atomic_fetch_add(&sw->next, 1, __ATOMIC_RELAXED)) < sw->winsize.n * sw->dlow.n) {
+		double winsize = sw->winsize.values[task / sw->dlow.n];
+		double dlow = sw->dlow.values[task % sw->dlow.n];
+
+		memset(&table, 0, sizeof(struct fittable_t));
+		if (sw->fittable) {
+			fittable_build(&table, &sw->fitcode, dlow, sw->fittable, sw->fiterr);
+		}
+		if (window_init(&window, (int)winsize) < 0) {
+			fittable_free(&table);
+			sw->failed = 1;
+			break;
+		}
+		for (i = 0; i < sw->trace.n; i++) {
+			instant[i] = estimator_instant(&window, sw->trace.delay[i], dlow, &sw->fitcode, &table, &fit_error);
+		}
+		window_free(&window);
+		fittable_free(&table);
+
+		for (k = 0; k < sw->w.n; k += EVAL_WBATCH) {
+			nw = sw->w.n - k < EVAL_WBATCH ? sw->w.n - k : EVAL_WBATCH;
+			for (j = 0; j < EVAL_WBATCH; j++) {
+				w[j] = sw->w.values[j < nw ? k + j : k];
+				load[j] = 0.0;
+				sum[j] = 0.0;
+			}
+			for (i = 0; i < sw->trace.n; i++) {
+				for (j = 0; j < EVAL_WBATCH; j++) {
+					load[j] = estimator_smooth(load[j], instant[i], w[j]);
+					err = load[j] - sw->trace.actual[i];
+					sum[j] += err * err;
+				}
+			}
+			for (j = 0; j < nw; j++) {
+				sw->mse[task * sw->w.n + k + j] = sum[j] / sw->trace.n;
+			}
+		}
+	}
+	free(instant);
+	return NULL;
+}
+
+void usage() {
+	fprintf(stderr, "Usage: leseval [options] trace\n"
+		"  trace: lines with the actual load (bit/s) and the delay (nsec) of a sample\n"
+		"  -W from[:to[:step]]: window sizes (default: 1:100:1)\n"
+		"  -w from[:to[:step]]: smoothing factors (default: 0:1:0.01)\n"
+		"  -d from[:to[:step]]: low load delay thresholds (default: 145000, step: 5000)\n"
+		"  -f fitfunc: fit function (default: %s)\n"
+		"  -t points: interpolation table size (default: 0, none)\n"
+		"  -e maxerr: max interpolation error (default: 0.001)\n"
+		"  -s scale: load reported as 1 (bit/s; default: %.0f)\n"
+		"  -z zeroload: loads up to this are reported as 0 (bit/s; default: %.0f)\n"
+		"  -j threads: worker threads (default: one per core)\n"
+		"Prints the mean squared error of each combination (winsize, w, dlow, MSE)\n"
+		"and reports the best one.\n", EVAL_FITFUNC, LABELLED_SCALE, LABELLED_ZEROLOAD);
+}
+
+int main(int argc, char **argv) {
+	pthread_t threads[EVAL_MAXTHREADS];
+	struct sweep_t sw;
+	struct timespec start, end;
+	char *winsize = "1:100:1";
+	char *w = "0:1:0.01";
+	char *dlow = "145000";
+	char *fitfunc = EVAL_FITFUNC;
+	double scale = LABELLED_SCALE;
+	double zeroload = LABELLED_ZEROLOAD;
+	int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int ncombs;
+	int best = 0;
+	int i, j, k;
+	int opt;
+
+	memset(&sw, 0, sizeof(struct sweep_t));
+	sw.fiterr = 0.001;
+	while ((opt = getopt(argc, argv, "W:w:d:f:t:e:s:z:j:")) != -1) {
+		switch (opt) {
+			case 'W': winsize = optarg; break;
+			case 'w': w = optarg; break;
+			case 'd': dlow = optarg; break;
+			case 'f': fitfunc = optarg; break;
+			case 't': sw.fittable = atoi(optarg); break;
+			case 'e': sw.fiterr = strtod(optarg, NULL); break;
+			case 's': scale = strtod(optarg, NULL); break;
+			case 'z': zeroload = strtod(optarg, NULL); break;
+			case 'j': nthreads = atoi(optarg); break;
+			default:
+				usage();
+				return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage();
+		return 1;
+	}
+	if (parse_range(winsize, 1, &sw.winsize) < 0 || sw.winsize.values[0] < 1
+		|| parse_range(w, 0.01, &sw.w) < 0 || sw.w.values[0] < 0 || sw.w.values[sw.w.n - 1] > 1
+		|| parse_range(dlow, 5000, &sw.dlow) < 0) {
+		fprintf(stderr, "Error: Invalid range\n");
+		return 1;
+	}
+	if (compile_fitfunc(fitfunc, &sw.fitcode) < 0) {
+		fprintf(stderr, "Error: Invalid fit function %s\n", fitfunc);
+		return 1;
+	}
+	if (scale <= 0 || sw.fittable < 0 || sw.fiterr <= 0) {
+		fprintf(stderr, "Error: Invalid option value\n");
+		return 1;
+	}
+	if (nthreads < 1) nthreads = 1;
+	if (nthreads > EVAL_MAXTHREADS) nthreads = EVAL_MAXTHREADS;
+
+	if (labelled_load(argv[optind], scale, zeroload, &sw.trace) < 0 || !sw.trace.n) {
+		fprintf(stderr, "Error: Could not read samples from %s\n", argv[optind]);
+		return 1;
+	}
+	ncombs = sw.winsize.n * sw.dlow.n * sw.w.n;
+	sw.mse = (double*)malloc(ncombs * sizeof(double));
+	if (!sw.mse) {
+		fprintf(stderr, "Error: Too many combinations\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, sweep_worker, &sw)) {
+			nthreads = i;
+			break;
+		}
+	}
+	if (!nthreads) {
+		/* run it here */
+		sweep_worker(&sw);
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	if (sw.failed) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < sw.winsize.n; i++) {
+		for (j = 0; j < sw.dlow.n; j++) {
+			for (k = 0; k < sw.w.n; k++) {
+				int c = (i * sw.dlow.n + j) * sw.w.n + k;
+				printf("%d\t%g\t%g\t%.9g\n", (int)sw.winsize.values[i], sw.w.values[k], sw.dlow.values[j], sw.mse[c]);
+				if (isnan(sw.mse[best]) || sw.mse[c] < sw.mse[best]) best = c;
+			}
+		}
+	}
+	fprintf(stderr, "%d combinations over %d samples in %.3f sec (%d threads)\n", ncombs, sw.trace.n,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9, nthreads ? nthreads : 1);
+	fprintf(stderr, "Best: winsize %d w %g dlow %g (MSE %.9g)\n", (int)sw.winsize.values[best / (sw.dlow.n * sw.w.n)],
+		sw.w.values[best % sw.w.n], sw.dlow.values[best / sw.w.n % sw.dlow.n], sw.mse[best]);
+	return 0;
+}
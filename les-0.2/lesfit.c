@@ -0,0 +1,570 @@
+/**
+ * lesfit.c -- Calibration of the fit function from a trace labelled with the
+ * actual load. The delay below which the load is 0 is chosen as dlow; the
+ * supported model families are then fitted to the samples above it with
+ * least squares, one thread per model, and the one with which the estimator
+ * does best is printed as fitfunc and dlow lines for the configuration file.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "estimator.h"
+#include "labelled.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+/* configuration values are at most 79 characters long */
+#define FIT_MAXLEN		79
+#define FIT_MAXPARAMS	4
+
+/* model families */
+#define MODEL_LINEAR	0 /* c0 + c1*X */
+#define MODEL_LNPOLY1	1 /* polynomial in ln(X/S) */
+#define MODEL_LNPOLY2	2
+#define MODEL_LNPOLY3	3
+#define MODEL_EXP1		4 /* a*e^(b*X) + c */
+#define MODEL_EXP2		5 /* a*e^(b*X) + c*e^(d*X) */
+#define NUM_MODELS		6
+
+/* starting exponents (per S) of the exponential models */
+#define FIT_NGRID		15
+static const double fit_grid[FIT_NGRID] = {-8, -4, -2, -1, -0.5, -0.25, -0.1, -0.05, 0.02, 0.05, 0.1, 0.25, 0.5, 1, 2};
+
+static const char *model_names[NUM_MODELS] = {"linear", "lnpoly1", "lnpoly2", "lnpoly3", "exp1", "exp2"};
+
+/**
+ * Samples the models are fitted to: window average delay (nsec) and actual
+ * load. Delays are scaled by S, their geometric mean rounded to 2 digits.
+ */
+struct fitdata_t {
+	double *x;
+	double *y;
+	int n;
+	double scale;
+};
+
+/**
+ * A fitted model.
+ */
+struct model_t {
+	int type;
+	struct fitdata_t *data;
+	/* coefficients (exponents per S) */
+	double p[FIT_MAXPARAMS];
+	int ok;
+	char fitfunc[FIT_MAXLEN + 1];
+	/* residuals of fitfunc over the fitted samples */
+	double rmse;
+	double maxerr;
+	double r2;
+	/* MSE of the estimator with fitfunc over the whole trace */
+	double mse;
+};
+
+/**
+ * Values of the basis functions of a model at scaled delay t, given the
+ * exponents of the exponential models in shape.
+ */
+static int basis(int type, double t, const double *shape, double *phi) {
+	switch (type) {
+		case MODEL_LINEAR:
+			phi[0] = 1;
+			phi[1] = t;
+			return 2;
+		case MODEL_LNPOLY1:
+		case MODEL_LNPOLY2:
+		case MODEL_LNPOLY3:
+			t = log(t);
+			phi[0] = 1;
+			phi[1] = t;
+			phi[2] = t * t;
+			phi[3] = t * t * t;
+			return type - MODEL_LNPOLY1 + 2;
+		case MODEL_EXP1:
+			phi[0] = exp(shape[0] * t);
+			phi[1] = 1;
+			return 2;
+		default:
+			phi[0] = exp(shape[0] * t);
+			phi[1] = exp(shape[1] * t);
+			return 2;
+	}
+}
+
+/**
+ * Solve the k x k system a*c = b by Gaussian elimination with partial
+ * pivoting (a and b are overwritten). Returns 0 on success or -1 if a is
+ * singular.
+ */
+static int solve(int k, double a[FIT_MAXPARAMS][FIT_MAXPARAMS], double *b, double *c) {
+	double f;
+	double tmp;
+	int i, j, r, piv;
+
+	for (i = 0; i < k; i++) {
+		piv = i;
+		for (r = i + 1; r < k; r++) {
+			if (fabs(a[r][i]) > fabs(a[piv][i])) piv = r;
+		}
+		if (!(fabs(a[piv][i]) > 1e-300)) {
+			return -1;
+		}
+		for (j = 0; j < k; j++) {
+			tmp = a[i][j]; a[i][j] = a[piv][j]; a[piv][j] = tmp;
+		}
+		tmp = b[i]; b[i] = b[piv]; b[piv] = tmp;
+		for (r = i + 1; r < k; r++) {
+			f = a[r][i] / a[i][i];
+			for (j = i; j < k; j++) a[r][j] -= f * a[i][j];
+			b[r] -= f * b[i];
+		}
+	}
+	for (i = k - 1; i >= 0; i--) {
+		c[i] = b[i];
+		for (j = i + 1; j < k; j++) c[i] -= a[i][j] * c[j];
+		c[i] /= a[i][i];
+	}
+	return 0;
+}
+
+/**
+ * Fit the linear coefficients of a model for the given exponents with least
+ * squares. Returns the sum of squared residuals, or HUGE_VAL on failure.
+ */
+static double lsq(struct fitdata_t *d, int type, const double *shape, double *coef) {
+	double a[FIT_MAXPARAMS][FIT_MAXPARAMS];
+	double b[FIT_MAXPARAMS];
+	double phi[FIT_MAXPARAMS];
+	double sse = 0.0;
+	double r;
+	int i, j, m, k = 0;
+
+	memset(a, 0, sizeof(a));
+	memset(b, 0, sizeof(b));
+	for (i = 0; i < d->n; i++) {
+		k = basis(type, d->x[i] / d->scale, shape, phi);
+		for (j = 0; j < k; j++) {
+			for (m = 0; m < k; m++) a[j][m] += phi[j] * phi[m];
+			b[j] += phi[j] * d->y[i];
+		}
+	}
+	if (solve(k, a, b, coef) < 0) {
+		return HUGE_VAL;
+	}
+	for (i = 0; i < d->n; i++) {
+		k = basis(type, d->x[i] / d->scale, shape, phi);
+		for (r = d->y[i], j = 0; j < k; j++) r -= coef[j] * phi[j];
+		sse += r * r;
+	}
+	return isfinite(sse) ? sse : HUGE_VAL;
+}
+
+/**
+ * Minimize the least squares error of an exponential model over its dim
+ * exponents (1 or 2) with the Nelder-Mead method, starting at shape, which
+ * is updated. Returns the error at the minimum.
+ */
+static double minimize(struct fitdata_t *d, int type, int dim, double *shape) {
+	double s[3][2];
+	double f[3];
+	double c[FIT_MAXPARAMS];
+	double centroid[2], xr[2], xe[2], xc[2];
+	double fr, fe, fc;
+	int iter, i, j, best, worst, next;
+
+	for (i = 0; i <= dim; i++) {
+		for (j = 0; j < dim; j++) {
+			s[i][j] = shape[j] * (i == j + 1 ? 1.2 : 1.0);
+		}
+		f[i] = lsq(d, type, s[i], c);
+	}
+	for (iter = 0; iter < 300; iter++) {
+		best = worst = 0;
+		for (i = 1; i <= dim; i++) {
+			if (f[i] < f[best]) best = i;
+			if (f[i] > f[worst]) worst = i;
+		}
+		next = best;
+		for (i = 0; i <= dim; i++) {
+			if (i != worst && f[i] >= f[next]) next = i;
+		}
+		if (f[worst] - f[best] <= 1e-12 * (f[best] + 1e-30)) {
+			break;
+		}
+		for (j = 0; j < dim; j++) {
+			centroid[j] = 0;
+			for (i = 0; i <= dim; i++) {
+				if (i != worst) centroid[j] += s[i][j] / dim;
+			}
+			xr[j] = 2 * centroid[j] - s[worst][j];
+		}
+		fr = lsq(d, type, xr, c);
+		if (fr < f[best]) {
+			/* expand */
+			for (j = 0; j < dim; j++) xe[j] = 3 * centroid[j] - 2 * s[worst][j];
+			fe = lsq(d, type, xe, c);
+			if (fe < fr) {
+				memcpy(s[worst], xe, sizeof(xe));
+				f[worst] = fe;
+			}
+			else {
+				memcpy(s[worst], xr, sizeof(xr));
+				f[worst] = fr;
+			}
+		}
+		else if (fr < f[next]) {
+			memcpy(s[worst], xr, sizeof(xr));
+			f[worst] = fr;
+		}
+		else {
+			/* contract, or shrink towards the best point */
+			for (j = 0; j < dim; j++) xc[j] = (centroid[j] + s[worst][j]) / 2;
+			fc = lsq(d, type, xc, c);
+			if (fc < f[worst]) {
+				memcpy(s[worst], xc, sizeof(xc));
+				f[worst] = fc;
+			}
+			else {
+				for (i = 0; i <= dim; i++) {
+					if (i == best) continue;
+					for (j = 0; j < dim; j++) s[i][j] = (s[i][j] + s[best][j]) / 2;
+					f[i] = lsq(d, type, s[i], c);
+				}
+			}
+		}
+	}
+	best = 0;
+	for (i = 1; i <= dim; i++) {
+		if (f[i] < f[best]) best = i;
+	}
+	memcpy(shape, s[best], dim * sizeof(double));
+	return f[best];
+}
+
+/**
+ * Fit a model (thread).
+ */
+static void *fit_model(void *arg) {
+	struct model_t *m = (struct model_t*)arg;
+	struct fitdata_t *d = m->data;
+	double shape[2] = {0, 0};
+	double best[2] = {0, 0};
+	double c[FIT_MAXPARAMS];
+	double sse;
+	double min = HUGE_VAL;
+	int i, j;
+
+	if (m->type < MODEL_EXP1) {
+		m->ok = lsq(d, m->type, shape, m->p) < HUGE_VAL;
+		return NULL;
+	}
+
+	/* the exponents are searched for, the coefficients solved for */
+	for (i = 0; i < FIT_NGRID; i++) {
+		for (j = m->type == MODEL_EXP1 ? 0 : i + 1; j < (m->type == MODEL_EXP1 ? 1 : FIT_NGRID); j++) {
+			shape[0] = fit_grid[i];
+			shape[1] = fit_grid[j];
+			sse = lsq(d, m->type, shape, c);
+			if (sse < min) {
+				min = sse;
+				best[0] = shape[0];
+				best[1] = shape[1];
+			}
+		}
+	}
+	if (min == HUGE_VAL) {
+		return NULL;
+	}
+	minimize(d, m->type, m->type == MODEL_EXP1 ? 1 : 2, best);
+	if (lsq(d, m->type, best, c) == HUGE_VAL) {
+		return NULL;
+	}
+	m->p[0] = c[0];
+	m->p[1] = best[0];
+	if (m->type == MODEL_EXP1) {
+		m->p[2] = c[1];
+	}
+	else {
+		m->p[2] = c[1];
+		m->p[3] = best[1];
+	}
+	m->ok = 1;
+	return NULL;
+}
+
+/**
+ * Format a fitted model as a fit function of X with prec significant digits
+ * per number.
+ */
+static void format_model(struct model_t *m, int prec, char *buf, int size) {
+	double s = m->data->scale;
+	double *p = m->p;
+
+	switch (m->type) {
+		case MODEL_LINEAR:
+			snprintf(buf, size, "%.*g%+.*g*X", prec, p[0], prec, p[1] / s);
+			break;
+		case MODEL_LNPOLY1:
+			snprintf(buf, size, "%.*g%+.*g*ln(X/%.0f)", prec, p[0], prec, p[1], s);
+			break;
+		case MODEL_LNPOLY2:
+			snprintf(buf, size, "%.*g+ln(X/%.0f)*(%.*g%+.*g*ln(X/%.0f))", prec, p[0], s, prec, p[1], prec, p[2], s);
+			break;
+		case MODEL_LNPOLY3:
+			snprintf(buf, size, "%.*g+ln(X/%.0f)*(%.*g+ln(X/%.0f)*(%.*g%+.*g*ln(X/%.0f)))", prec, p[0], s, prec, p[1],
+				s, prec, p[2], prec, p[3], s);
+			break;
+		case MODEL_EXP1:
+			snprintf(buf, size, "%.*g*e^(%.*g*X)%+.*g", prec, p[0], prec, p[1] / s, prec, p[2]);
+			break;
+		default:
+			snprintf(buf, size, "%.*g*e^(%.*g*X)%+.*g*e^(%.*g*X)", prec, p[0], prec, p[1] / s, prec, p[2], prec,
+				p[3] / s);
+	}
+}
+
+/**
+ * Round v to the given number of significant digits.
+ */
+static double round_digits(double v, int digits) {
+	char buf[32];
+
+	snprintf(buf, sizeof(buf), "%.*g", digits, v);
+	return atof(buf);
+}
+
+static int cmp_abs(const void *a, const void *b) {
+	double x = fabs(*(const double*)a);
+	double y = fabs(*(const double*)b);
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Return the delay (rounded to 2 digits) above which samples are loaded,
+ * chosen to minimize the mean of the rates of misclassified zero-load and
+ * loaded samples, or 0 if either kind is missing.
+ */
+static double choose_dlow(double *x, double *y, int n) {
+	double *sorted;
+	double err;
+	double min = HUGE_VAL;
+	double dlow = 0.0;
+	int zeros = 0;
+	int zeros_below = 0;
+	int loaded_below = 0;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (y[i] == 0.0) zeros++;
+	}
+	if (!zeros || zeros == n) {
+		return 0.0;
+	}
+	/* sorted by delay; zero loads are marked by a negative sign */
+	sorted = (double*)malloc(n * sizeof(double));
+	if (!sorted) {
+		return 0.0;
+	}
+	for (i = 0; i < n; i++) {
+		sorted[i] = y[i] == 0.0 ? -x[i] : x[i];
+	}
+	qsort(sorted, n, sizeof(double), cmp_abs);
+	for (i = 0; i < n; i++) {
+		/* threshold at sorted[i]: samples before it are taken as zero loads */
+		if (i == 0 || fabs(sorted[i]) != fabs(sorted[i - 1])) {
+			err = (double)(zeros - zeros_below) / zeros + (double)loaded_below / (n - zeros);
+			if (err < min) {
+				min = err;
+				dlow = fabs(sorted[i]);
+			}
+		}
+		if (sorted[i] < 0) zeros_below++;
+		else loaded_below++;
+	}
+	free(sorted);
+	return round_digits(dlow, 2);
+}
+
+int main(int argc, char **argv) {
+	struct labelled_t trace;
+	struct fitdata_t data;
+	struct model_t models[NUM_MODELS];
+	pthread_t threads[NUM_MODELS];
+	int running[NUM_MODELS];
+	struct fitfunc_t fitcode;
+	struct fittable_t table;
+	struct window_t window;
+	struct timespec start, end;
+	char buf[256];
+	double *avg;
+	double scale = LABELLED_SCALE;
+	double zeroload = LABELLED_ZEROLOAD;
+	double dlow = -1;
+	double logsum = 0.0;
+	double ymean = 0.0;
+	double sst, sse, err, l;
+	int winsize = 1;
+	int best = -1;
+	int fit_error;
+	int prec;
+	int opt;
+	int i, k;
+
+	while ((opt = getopt(argc, argv, "W:d:s:z:")) != -1) {
+		switch (opt) {
+			case 'W': winsize = atoi(optarg); break;
+			case 'd': dlow = strtod(optarg, NULL); break;
+			case 's': scale = strtod(optarg, NULL); break;
+			case 'z': zeroload = strtod(optarg, NULL); break;
+			default:
+				optind = argc;
+		}
+	}
+	if (optind != argc - 1 || winsize < 1 || scale <= 0) {
+		fprintf(stderr, "Usage: lesfit [-W winsize] [-d dlow] [-s scale] [-z zeroload] trace\n"
+			"  trace: lines with the actual load (bit/s) and the delay (nsec) of a sample\n"
+			"  -W winsize: sample window size of the estimator (default: 1)\n"
+			"  -d dlow: low load delay threshold (default: chosen from the trace)\n"
+			"  -s scale: load reported as 1 (bit/s; default: %.0f)\n"
+			"  -z zeroload: loads up to this are reported as 0 (bit/s; default: %.0f)\n"
+			"Fits the fit function models to the samples above dlow and prints the fitfunc\n"
+			"and dlow lines of the best one.\n", LABELLED_SCALE, LABELLED_ZEROLOAD);
+		return 1;
+	}
+	if (labelled_load(argv[optind], scale, zeroload, &trace) < 0 || !trace.n) {
+		fprintf(stderr, "Error: Could not read samples from %s\n", argv[optind]);
+		return 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	/* the estimator maps window averages, not single samples */
+	avg = (double*)malloc(trace.n * sizeof(double));
+	data.x = (double*)malloc(trace.n * sizeof(double));
+	data.y = (double*)malloc(trace.n * sizeof(double));
+	if (!avg || !data.x || !data.y || window_init(&window, winsize) < 0) {
+		fprintf(stderr, "Error: Out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < trace.n; i++) {
+		window_slide(&window, trace.delay[i]);
+		avg[i] = window_average(&window);
+	}
+	window_free(&window);
+
+	if (dlow < 0) {
+		dlow = choose_dlow(avg, trace.actual, trace.n);
+		if (!dlow) {
+			fprintf(stderr, "Warning: no zero-load or no loaded samples, dlow set to 0\n");
+		}
+	}
+
+	/* the fit function is used above dlow, and up to a load of 1 */
+	data.n = 0;
+	for (i = 0; i < trace.n; i++) {
+		if (avg[i] >= dlow && trace.actual[i] > 0 && trace.actual[i] < 1) {
+			data.x[data.n] = avg[i];
+			data.y[data.n] = trace.actual[i];
+			logsum += log(avg[i]);
+			ymean += trace.actual[i];
+			data.n++;
+		}
+	}
+	if (data.n < 2 * FIT_MAXPARAMS) {
+		fprintf(stderr, "Error: Too few samples above dlow with a load in (0, 1): %d\n", data.n);
+		return 1;
+	}
+	ymean /= data.n;
+	data.scale = round_digits(exp(logsum / data.n), 2);
+
+	for (i = 0; i < NUM_MODELS; i++) {
+		memset(&models[i], 0, sizeof(struct model_t));
+		models[i].type = i;
+		models[i].data = &data;
+		running[i] = !pthread_create(&threads[i], NULL, fit_model, &models[i]);
+		if (!running[i]) {
+			fit_model(&models[i]);
+		}
+	}
+	for (i = 0; i < NUM_MODELS; i++) {
+		if (running[i]) pthread_join(threads[i], NULL);
+	}
+
+	/* the fit function parser is not reentrant: the rest is done here */
+	memset(&table, 0, sizeof(struct fittable_t));
+	for (i = 0; i < NUM_MODELS; i++) {
+		struct model_t *m = &models[i];
+		if (!m->ok) continue;
+
+		/* as many digits as fit in a configuration value */
+		for (prec = 10; prec >= 3; prec--) {
+			format_model(m, prec, buf, sizeof(buf));
+			if (strlen(buf) <= FIT_MAXLEN && compile_fitfunc(buf, &fitcode) == 0) break;
+		}
+		strcpy(m->fitfunc, buf);
+		if (prec < 3) {
+			m->ok = 0;
+			continue;
+		}
+
+		/* residuals of the fit function as printed */
+		sse = sst = 0.0;
+		for (k = 0; k < data.n; k++) {
+			err = map_to_load(&fitcode, data.x[k]) - data.y[k];
+			sse += err * err;
+			sst += (data.y[k] - ymean) * (data.y[k] - ymean);
+			if (fabs(err) > m->maxerr || !isfinite(err)) m->maxerr = fabs(err);
+		}
+		m->rmse = sqrt(sse / data.n);
+		m->r2 = 1 - sse / sst;
+
+		/* error of the instant load estimate of LES with it */
+		window_init(&window, winsize);
+		for (sse = 0.0, k = 0; k < trace.n; k++) {
+			l = estimator_instant(&window, trace.delay[k], dlow, &fitcode, &table, &fit_error);
+			sse += (l - trace.actual[k]) * (l - trace.actual[k]);
+		}
+		window_free(&window);
+		m->mse = isfinite(sse) ? sse / trace.n : HUGE_VAL;
+		if (best < 0 || m->mse < models[best].mse) best = i;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "%d samples, %d above dlow %g with a load in (0, 1), fitted in %.3f sec\n", trace.n, data.n, dlow,
+		(end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	fprintf(stderr, "%-8s %9s %9s %9s %11s  %s\n", "model", "RMSE", "max err", "R^2", "instant MSE", "fitfunc");
+	for (i = 0; i < NUM_MODELS; i++) {
+		if (!models[i].ok) {
+			fprintf(stderr, "%-8s (no fit)\n", model_names[i]);
+			continue;
+		}
+		fprintf(stderr, "%-8s %9.5f %9.5f %9.5f %11.6f  %s\n", model_names[i], models[i].rmse, models[i].maxerr,
+			models[i].r2, models[i].mse, models[i].fitfunc);
+	}
+	if (best < 0) {
+		fprintf(stderr, "Error: No model could be fitted\n");
+		return 1;
+	}
+	printf("fitfunc %s\ndlow %.0f\n", models[best].fitfunc, dlow);
+
+	labelled_free(&trace);
+	return 0;
+}
@@ -0,0 +1,318 @@
+/**
+ * metrics.c -- Registry of internal counters and latency histograms.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "metrics.h"
+
+/**
+ * A registered counter or histogram.
+ */
+struct metric_t {
+	char *name;
+	char *help;
+	char labels[METRICS_LABELLEN];
+	void *counter;
+	int size;
+	struct metrics_hist_t *hist;
+	/* per-thread counter or histogram number (-1: none) */
+	int local;
+	int local_hist;
+};
+
+static const unsigned long long metrics_bounds[METRICS_NBUCKETS] = METRICS_BUCKETS;
+
+static struct metric_t metrics[METRICS_MAX];
+static int nmetrics = 0;
+static int metrics_sockfd = -1;
+
+/* per-thread blocks, the first nlocal of which are in use */
+static struct metrics_local_t metrics_locals[METRICS_MAXTHREADS];
+static int nlocal = 0;
+__thread struct metrics_local_t *metrics_self = NULL;
+
+/**
+ * Get a block of per-thread counters for the calling thread.
+ */
+struct metrics_local_t *metrics_local_claim() {
+	int i = __atomic_fetch_add(&nlocal, 1, __ATOMIC_RELAXED);
+
+	if (i >= METRICS_MAXTHREADS - 1) {
+		/* out of blocks: the last one is shared */
+		i = METRICS_MAXTHREADS - 1;
+		__atomic_store_n(&metrics_locals[i].shared, 1, __ATOMIC_RELAXED);
+	}
+	metrics_self = &metrics_locals[i];
+	return metrics_self;
+}
+
+/**
+ * Record a value (usec) in per-thread histogram number hist of the calling
+ * thread.
+ */
+void metrics_local_observe(int hist, unsigned long long usec) {
+	struct metrics_local_t *l = metrics_local();
+	struct metrics_hist_t *h = &l->hists[hist];
+	int i;
+
+	for (i = 0; i < METRICS_NBUCKETS && usec > metrics_bounds[i]; i++);
+	metrics_local_inc(l, &h->counts[i], 1);
+	metrics_local_inc(l, &h->count, 1);
+	metrics_local_inc(l, &h->sum, usec);
+}
+
+static int metrics_add_entry(char *name, char *help, char *labels, void *counter, int size, struct metrics_hist_t *hist) {
+	struct metric_t *m;
+
+	if (nmetrics == METRICS_MAX) {
+		return -1;
+	}
+	m = &metrics[nmetrics++];
+	m->name = name;
+	m->help = help;
+	strncpy(m->labels, labels ? labels : "", METRICS_LABELLEN - 1);
+	m->counter = counter;
+	m->size = size;
+	m->hist = hist;
+	m->local = -1;
+	m->local_hist = -1;
+	return 0;
+}
+
+/**
+ * Register a counter of the given size (sizeof(unsigned int) or
+ * sizeof(unsigned long long)) as name{labels}. labels is a list of
+ * label="value" pairs, or NULL. Counters of the same name should be
+ * registered with the same help text. Returns 0 on success or -1 if the
+ * registry is full.
+ */
+int metrics_register(char *name, char *help, char *labels, void *counter, int size) {
+	return metrics_add_entry(name, help, labels, counter, size, NULL);
+}
+
+/**
+ * Register a histogram (see metrics_register()).
+ */
+int metrics_register_hist(char *name, char *help, char *labels, struct metrics_hist_t *hist) {
+	return metrics_add_entry(name, help, labels, NULL, 0, hist);
+}
+
+/**
+ * Register per-thread counter number counter, reported as the sum over the
+ * threads (see metrics_register()).
+ */
+int metrics_register_local(char *name, char *help, char *labels, int counter) {
+	if (metrics_add_entry(name, help, labels, NULL, 0, NULL) < 0) {
+		return -1;
+	}
+	metrics[nmetrics - 1].local = counter;
+	return 0;
+}
+
+/**
+ * Register per-thread histogram number hist, reported as the sum over the
+ * threads (see metrics_register()).
+ */
+int metrics_register_local_hist(char *name, char *help, char *labels, int hist) {
+	if (metrics_add_entry(name, help, labels, NULL, 0, NULL) < 0) {
+		return -1;
+	}
+	metrics[nmetrics - 1].local_hist = hist;
+	return 0;
+}
+
+/**
+ * Number of per-thread blocks in use.
+ */
+static int metrics_nlocal() {
+	int n = __atomic_load_n(&nlocal, __ATOMIC_RELAXED);
+	return n < METRICS_MAXTHREADS ? n : METRICS_MAXTHREADS;
+}
+
+/**
+ * Format the samples of histogram h.
+ */
+static int metrics_render_hist(struct metric_t *m, struct metrics_hist_t *h, char *buf, int size) {
+	char labels[METRICS_LABELLEN + 2];
+	char *sep = *m->labels ? "," : "";
+	unsigned long long cum = 0;
+	int len = 0;
+	int i;
+
+	for (i = 0; i <= METRICS_NBUCKETS && len < size; i++) {
+		cum += __atomic_load_n(&h->counts[i], __ATOMIC_RELAXED);
+		if (i < METRICS_NBUCKETS) {
+			len += snprintf(buf + len, size - len, "%s_bucket{%s%sle=\"%g\"} %llu\n", m->name, m->labels, sep,
+				metrics_bounds[i] / 1e6, cum);
+		}
+		else {
+			len += snprintf(buf + len, size - len, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", m->name, m->labels, sep, cum);
+		}
+	}
+	if (len < size) {
+		snprintf(labels, sizeof(labels), *m->labels ? "{%s}" : "", m->labels);
+		len += snprintf(buf + len, size - len, "%s_sum%s %g\n%s_count%s %llu\n", m->name, labels,
+			__atomic_load_n(&h->sum, __ATOMIC_RELAXED) / 1e6, m->name, labels,
+			__atomic_load_n(&h->count, __ATOMIC_RELAXED));
+	}
+	return len;
+}
+
+/**
+ * Format all metrics in the Prometheus text format into buf (of size
+ * bytes) and return the length.
+ */
+int metrics_render(char *buf, int size) {
+	char labels[METRICS_LABELLEN + 2];
+	struct metrics_hist_t sum;
+	struct metrics_hist_t *h;
+	struct metric_t *m;
+	unsigned long long value;
+	int len = 0;
+	int i, j, k, b;
+
+	for (i = 0; i < nmetrics && len < size; i++) {
+		/* samples of a metric are listed together, after its first one */
+		for (j = 0; j < i && strcmp(metrics[j].name, metrics[i].name); j++);
+		if (j < i) continue;
+
+		len += snprintf(buf + len, size - len, "# HELP %s %s\n# TYPE %s %s\n", metrics[i].name, metrics[i].help,
+			metrics[i].name, (metrics[i].hist || metrics[i].local_hist >= 0) ? "histogram" : "counter");
+		for (j = i; j < nmetrics && len < size; j++) {
+			m = &metrics[j];
+			if (strcmp(m->name, metrics[i].name)) continue;
+			if (m->hist) {
+				len += metrics_render_hist(m, m->hist, buf + len, size - len);
+				continue;
+			}
+			if (m->local_hist >= 0) {
+				memset(&sum, 0, sizeof(struct metrics_hist_t));
+				for (k = 0; k < metrics_nlocal(); k++) {
+					h = &metrics_locals[k].hists[m->local_hist];
+					for (b = 0; b <= METRICS_NBUCKETS; b++) {
+						sum.counts[b] += __atomic_load_n(&h->counts[b], __ATOMIC_RELAXED);
+					}
+					sum.count += __atomic_load_n(&h->count, __ATOMIC_RELAXED);
+					sum.sum += __atomic_load_n(&h->sum, __ATOMIC_RELAXED);
+				}
+				len += metrics_render_hist(m, &sum, buf + len, size - len);
+				continue;
+			}
+			if (m->local >= 0) {
+				value = 0;
+				for (k = 0; k < metrics_nlocal(); k++) {
+					value += __atomic_load_n(&metrics_locals[k].counters[m->local], __ATOMIC_RELAXED);
+				}
+			}
+			else if (m->size == sizeof(unsigned long long)) {
+				value = __atomic_load_n((unsigned long long*)m->counter, __ATOMIC_RELAXED);
+			}
+			else {
+				value = __atomic_load_n((unsigned int*)m->counter, __ATOMIC_RELAXED);
+			}
+			snprintf(labels, sizeof(labels), *m->labels ? "{%s}" : "", m->labels);
+			len += snprintf(buf + len, size - len, "%s%s %llu\n", m->name, labels, value);
+		}
+	}
+	return len < size ? len : size - 1;
+}
+
+/**
+ * Write len bytes of buf to fd. Returns 0 on success or -1 if the client
+ * went away.
+ */
+static int metrics_write(int fd, char *buf, int len) {
+	int n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n <= 0) return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/**
+ * Answer HTTP requests with the metrics, one connection at a time.
+ */
+static void *metrics_serve(void *arg) {
+	struct timeval timeout = {1, 0};
+	char request[1024];
+	char header[128];
+	char *body;
+	int hlen;
+	int blen;
+	int fd;
+
+	body = (char*)malloc(METRICS_BUFLEN);
+	if (!body) {
+		return NULL;
+	}
+	while (1) {
+		fd = accept(metrics_sockfd, NULL, NULL);
+		if (fd < 0) {
+			continue;
+		}
+		/* the request itself does not matter */
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		if (recv(fd, request, sizeof(request), 0) > 0) {
+			blen = metrics_render(body, METRICS_BUFLEN);
+			hlen = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: %d\r\n\r\n", blen);
+			if (metrics_write(fd, header, hlen) == 0) {
+				metrics_write(fd, body, blen);
+			}
+		}
+		close(fd);
+	}
+	return NULL;
+}
+
+/**
+ * Serve the metrics over HTTP on 127.0.0.1:port from a thread of their own.
+ * Returns 0 on success or -1 if the port cannot be bound.
+ */
+int metrics_start(int port) {
+	struct sockaddr_in addr;
+	pthread_t thread;
+	int on = 1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+
+	metrics_sockfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (metrics_sockfd < 0) {
+		return -1;
+	}
+	/* the server closes first, leaving every scrape in TIME_WAIT on this
+	   port: allow binding it again when LES is restarted */
+	setsockopt(metrics_sockfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if (bind(metrics_sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(metrics_sockfd, SOMAXCONN) < 0) {
+		close(metrics_sockfd);
+		metrics_sockfd = -1;
+		return -1;
+	}
+	if (pthread_create(&thread, NULL, metrics_serve, NULL)) {
+		return -1;
+	}
+	pthread_detach(thread);
+	return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * metrics.h -- Registry of internal counters and latency histograms, exposed
+ * in the Prometheus text format on a local HTTP port.
+ *
+ * Counters are plain integers owned by the code that updates them; the
+ * registry only keeps their address. A counter written by a single thread is
+ * updated with metrics_inc() (a relaxed store, no locked instruction), one
+ * written by several threads with metrics_add() (a relaxed atomic add).
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "netfunc.h"
+
+#define METRICS_MAX			256
+#define METRICS_LABELLEN	64
+
+/* histogram bucket upper bounds (usec) */
+#define METRICS_NBUCKETS	12
+#define METRICS_BUCKETS		{1, 2, 5, 10, 25, 50, 100, 250, 500, 1000, 10000, 100000}
+
+/* max size of the exposition */
+#define METRICS_BUFLEN		65536
+
+/**
+ * Latency histogram with fixed buckets; counts[METRICS_NBUCKETS] counts
+ * values above the last bound.
+ */
+struct metrics_hist_t {
+	unsigned long long counts[METRICS_NBUCKETS + 1];
+	unsigned long long count;
+	/* usec */
+	unsigned long long sum;
+};
+
+/* counters and histograms kept per thread, e.g., by request handlers */
+#define METRICS_NLOCAL		8
+#define METRICS_NLOCALHIST	1
+/* threads with a block of their own (the UDP workers and the reactor); any
+ * more share the last one */
+#define METRICS_MAXTHREADS	(UDPPOOL_MAXWORKERS + 1)
+
+/**
+ * Per-thread counters and histograms, written by their thread only (unless
+ * shared) and summed when rendered. Each block is on cache lines of its own,
+ * so threads counting the same events do not contend.
+ */
+struct metrics_local_t {
+	unsigned long long counters[METRICS_NLOCAL];
+	struct metrics_hist_t hists[METRICS_NLOCALHIST];
+	/* set if several threads write to the block */
+	int shared;
+} __attribute__((aligned(64)));
+
+/* block of the calling thread (NULL until it counts something) */
+extern __thread struct metrics_local_t *metrics_self;
+
+/**
+ * Count an event in a counter written by a single thread.
+ */
+static inline void metrics_inc(unsigned int *counter) {
+	__atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get a block of per-thread counters for the calling thread.
+ */
+struct metrics_local_t *metrics_local_claim();
+
+/**
+ * Block of per-thread counters of the calling thread.
+ */
+static inline struct metrics_local_t *metrics_local() {
+	return metrics_self ? metrics_self : metrics_local_claim();
+}
+
+/**
+ * Add n to a counter of per-thread block l.
+ */
+static inline void metrics_local_inc(struct metrics_local_t *l, unsigned long long *counter, unsigned long long n) {
+	if (l->shared) {
+		__atomic_fetch_add(counter, n, __ATOMIC_RELAXED);
+	}
+	else {
+		__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Add n to per-thread counter number counter of the calling thread.
+ */
+static inline void metrics_local_add(int counter, unsigned long long n) {
+	struct metrics_local_t *l = metrics_local();
+
+	metrics_local_inc(l, &l->counters[counter], n);
+}
+
+/**
+ * Record a value (usec) in per-thread histogram number hist of the calling
+ * thread.
+ */
+void metrics_local_observe(int hist, unsigned long long usec);
+
+/**
+ * Register a counter of the given size (sizeof(unsigned int) or
+ * sizeof(unsigned long long)) as name{labels}. labels is a list of
+ * label="value" pairs, or NULL. Counters of the same name should be
+ * registered with the same help text. Returns 0 on success or -1 if the
+ * registry is full.
+ */
+int metrics_register(char *name, char *help, char *labels, void *counter, int size);
+
+/**
+ * Register a histogram (see metrics_register()).
+ */
+int metrics_register_hist(char *name, char *help, char *labels, struct metrics_hist_t *hist);
+
+/**
+ * Register per-thread counter number counter, reported as the sum over the
+ * threads (see metrics_register()).
+ */
+int metrics_register_local(char *name, char *help, char *labels, int counter);
+
+/**
+ * Register per-thread histogram number hist, reported as the sum over the
+ * threads (see metrics_register()).
+ */
+int metrics_register_local_hist(char *name, char *help, char *labels, int hist);
+
+/**
+ * Format all metrics in the Prometheus text format into buf (of size
+ * bytes) and return the length.
+ */
+int metrics_render(char *buf, int size);
+
+/**
+ * Serve the metrics over HTTP on 127.0.0.1:port from a thread of their own.
+ * Returns 0 on success or -1 if the port cannot be bound.
+ */
+int metrics_start(int port);
+
+#endif
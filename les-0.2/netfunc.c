@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#define _GNU_SOURCE /* recvmmsg(), sendmmsg() */
 #include "netfunc.h"
 
 /**
@@ -53,7 +54,7 @@ int init_server(struct cnx_info_t* info) {
 	}
 
 	if (info->proto == _PROTO_TCP_) {
-		if (listen(server_sockfd, 20) < 0) {
+		if (listen(server_sockfd, SOMAXCONN) < 0) {
 			return -3;
 		}
 	}
@@ -92,6 +93,76 @@ int init_client_connection(struct cnx_info_t* info) {
 	return sockfd;
 }
 
+/**
+ * Sets up a UDP socket for sending datagrams to the multicast group and port
+ * of info with the given TTL (see write_data()). Multicast loopback is
+ * enabled so that local receivers get the datagrams too.
+ * Returns the socket descriptor or < 0 on error.
+ */
+int init_multicast_sender(struct cnx_info_t *info, int ttl) {
+	unsigned char mttl = ttl;
+	unsigned char loop = 1;
+	int sockfd;
+
+	memset(&(info->addr), 0, sizeof(info->addr));
+	info->addr.sin_family = AF_INET;
+	if (!inet_aton(info->host, &(info->addr.sin_addr)) || !IN_MULTICAST(ntohl(info->addr.sin_addr.s_addr))) {
+		return -1;
+	}
+	info->addr.sin_port = htons(info->port);
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd < 0) {
+		return -2;
+	}
+	if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &mttl, sizeof(mttl)) < 0
+		|| setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+		close(sockfd);
+		return -3;
+	}
+
+	info->proto = _PROTO_UDP_;
+	info->sockfd = sockfd;
+	return sockfd;
+}
+
+/**
+ * Sets up a UDP socket receiving datagrams sent to the multicast group and
+ * port of info (see read_data()). Several receivers may share the port.
+ * Returns the socket descriptor or < 0 on error.
+ */
+int init_multicast_receiver(struct cnx_info_t *info) {
+	struct ip_mreq mreq;
+	int one = 1;
+	int sockfd;
+
+	memset(&mreq, 0, sizeof(mreq));
+	if (!inet_aton(info->host, &mreq.imr_multiaddr) || !IN_MULTICAST(ntohl(mreq.imr_multiaddr.s_addr))) {
+		return -1;
+	}
+	mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+
+	memset(&(info->addr), 0, sizeof(info->addr));
+	info->addr.sin_family = AF_INET;
+	info->addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	info->addr.sin_port = htons(info->port);
+
+	sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (sockfd < 0) {
+		return -2;
+	}
+	if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+		|| bind(sockfd, (struct sockaddr *)&(info->addr), sizeof(info->addr)) < 0
+		|| setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+		close(sockfd);
+		return -3;
+	}
+
+	info->proto = _PROTO_UDP_;
+	info->sockfd = sockfd;
+	return sockfd;
+}
+
 /**
  * Calls accept() on a TCP server socket and returns the client socket
  * or returns ERR_ACCEPT_ON_UPD
@@ -246,3 +317,695 @@ int wait_for_data(struct cnx_info_t* info, int msec, int from_client) {
 	}
 }
 
+
+/**
+ * Current time in msec (monotonic clock).
+ */
+static long long now_msec() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	if (flags < 0) return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/**
+ * Remove a connection from the reactor list.
+ */
+static void conn_unlink(struct reactor_t *r, struct conn_t *c) {
+	if (c->prev) c->prev->next = c->next;
+	else if (c->sub.active) r->subs = c->next;
+	else r->conns = c->next;
+	if (c->next) c->next->prev = c->prev;
+	else if (!c->sub.active) r->conns_tail = c->prev;
+	c->prev = c->next = NULL;
+}
+
+/**
+ * Add a connection to the head of the reactor list (or the subscriber list).
+ */
+static void conn_link(struct reactor_t *r, struct conn_t *c) {
+	c->prev = NULL;
+	if (c->sub.active) {
+		c->next = r->subs;
+		if (r->subs) r->subs->prev = c;
+		r->subs = c;
+		return;
+	}
+	c->next = r->conns;
+	if (r->conns) r->conns->prev = c;
+	else r->conns_tail = c;
+	r->conns = c;
+}
+
+/**
+ * Close a connection and free it.
+ */
+static void reactor_drop(struct reactor_t *r, struct conn_t *c) {
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+	close(c->fd);
+	conn_unlink(r, c);
+	if (c->sub.active) {
+		__atomic_store_n(&r->nsubs, r->nsubs - 1, __ATOMIC_RELAXED);
+	}
+	free(c->in);
+	free(c->out);
+	free(c);
+	r->nconns--;
+}
+
+/**
+ * Accept pending TCP connections.
+ */
+static void reactor_accept(struct reactor_t *r) {
+	struct epoll_event ev;
+	struct conn_t *c;
+	int fd;
+	int i;
+
+	for (i = 0; i < REACTOR_MAXEVENTS; i++) {
+		fd = accept(r->tcp_sockfd, NULL, NULL);
+		if (fd < 0) break;
+
+		c = (struct conn_t*)malloc(sizeof(struct conn_t));
+		if (!c || set_nonblocking(fd) < 0) {
+			if (c) free(c);
+			close(fd);
+			continue;
+		}
+		memset(c, 0, sizeof(struct conn_t));
+		c->fd = fd;
+		c->last = now_msec();
+		c->events = EPOLLIN | EPOLLRDHUP;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = c->events;
+		ev.data.ptr = c;
+		if (epoll_ctl(r->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			free(c);
+			close(fd);
+			continue;
+		}
+		conn_link(r, c);
+		r->nconns++;
+	}
+}
+
+/**
+ * Append len bytes to the replies pending on a connection, allocating its
+ * output buffer if needed. The caller checks that they fit. Returns -1 if out
+ * of memory.
+ */
+static int conn_queue(struct conn_t *c, char *data, int len) {
+	if (!c->out) {
+		c->out = (char*)malloc(REACTOR_OUTLEN);
+		if (!c->out) return -1;
+	}
+	memcpy(c->out + c->outlen, data, len);
+	c->outlen += len;
+	return 0;
+}
+
+/**
+ * Send pending replies. Returns -1 if the connection failed.
+ */
+static int reactor_flush(struct reactor_t *r, struct conn_t *c) {
+	struct epoll_event ev;
+	unsigned int events;
+	int sent;
+
+	while (c->outlen > 0) {
+		sent = send(c->fd, c->out, c->outlen, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return -1;
+		}
+		memmove(c->out, c->out + sent, c->outlen - sent);
+		c->outlen -= sent;
+	}
+	if (!c->outlen && c->out && !c->sub.active) {
+		/* most connections only ever have a reply pending for a moment */
+		free(c->out);
+		c->out = NULL;
+	}
+
+	/* wait for the socket to become writable only while replies are pending,
+	 * and read requests only while there is room for their replies */
+	events = EPOLLRDHUP | (c->outlen > 0 ? EPOLLOUT : 0) | (REACTOR_OUTLEN - c->outlen >= REACTOR_REPLYLEN ? EPOLLIN : 0);
+	if (events != c->events) {
+		c->events = events;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = events;
+		ev.data.ptr = c;
+		epoll_ctl(r->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+	}
+	return 0;
+}
+
+/**
+ * Serve the complete messages in the len bytes of data received on a
+ * connection while there is room for their replies; the rest are served once
+ * the client reads its replies. Returns the number of bytes consumed, or -1
+ * if the connection should be closed.
+ */
+static int reactor_serve(struct reactor_t *r, struct conn_t *c, char *data, int len) {
+	char reply[REACTOR_REPLYLEN];
+	struct subscription_t sub;
+	int replylen;
+	int done = 0;
+	int used;
+
+	while (done < len) {
+		if (REACTOR_OUTLEN - c->outlen < REACTOR_REPLYLEN) {
+			return done;
+		}
+		replylen = 0;
+		sub = c->sub;
+		used = r->handler(data + done, len - done, reply, &replylen, &sub);
+		if (used < 0) return -1;
+		if (used == 0) break;
+
+		if (sub.active && !c->sub.active) {
+			/* move to the subscriber list; the reply is the first push */
+			conn_unlink(r, c);
+			sub.last_push = c->last;
+			c->sub = sub;
+			conn_link(r, c);
+			__atomic_store_n(&r->nsubs, r->nsubs + 1, __ATOMIC_RELAXED);
+		}
+		else {
+			c->sub = sub;
+		}
+
+		if (replylen > 0 && conn_queue(c, reply, replylen) < 0) {
+			return -1;
+		}
+		done += used;
+	}
+
+	if (len - done == REACTOR_BUFLEN) {
+		/* not a message: any would fit in the buffer */
+		return -1;
+	}
+	return done;
+}
+
+/**
+ * Serve the messages held in the input buffer of a connection, releasing the
+ * buffer once they are all consumed. Returns -1 if the connection should be
+ * closed.
+ */
+static int reactor_serve_held(struct reactor_t *r, struct conn_t *c) {
+	int used = reactor_serve(r, c, c->in, c->inlen);
+
+	if (used < 0) return -1;
+	c->inlen -= used;
+	if (!c->inlen) {
+		free(c->in);
+		c->in = NULL;
+	}
+	else if (used) {
+		memmove(c->in, c->in + used, c->inlen);
+	}
+	return 0;
+}
+
+/**
+ * Send pending replies and serve the requests received, as long as the
+ * replies can be sent. Returns -1 if the connection should be closed.
+ */
+static int reactor_write(struct reactor_t *r, struct conn_t *c) {
+	int inlen;
+
+	if (reactor_flush(r, c) < 0) {
+		return -1;
+	}
+	while (c->inlen > 0 && REACTOR_OUTLEN - c->outlen >= REACTOR_REPLYLEN) {
+		inlen = c->inlen;
+		if (reactor_serve_held(r, c) < 0 || reactor_flush(r, c) < 0) {
+			return -1;
+		}
+		if (c->inlen == inlen) {
+			/* the rest of a message is yet to come */
+			break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Read data from a connection and serve the complete messages received.
+ * Returns -1 if the connection should be closed.
+ */
+static int reactor_read(struct reactor_t *r, struct conn_t *c) {
+	char data[REACTOR_BUFLEN];
+	int used;
+	int n;
+
+	if (c->inlen == REACTOR_BUFLEN) {
+		/* requests held back until there is room for their replies */
+		return 0;
+	}
+	if (c->inlen > 0) {
+		/* append to the rest of a message or the requests held back */
+		n = recv(c->fd, c->in + c->inlen, REACTOR_BUFLEN - c->inlen, 0);
+	}
+	else {
+		n = recv(c->fd, data, REACTOR_BUFLEN, 0);
+	}
+	if (n == 0) {
+		/* peer closed the connection */
+		return -1;
+	}
+	if (n < 0) {
+		return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+	}
+
+	/* keep the list ordered by activity */
+	c->last = now_msec();
+	conn_unlink(r, c);
+	conn_link(r, c);
+
+	if (c->inlen > 0) {
+		c->inlen += n;
+		return reactor_write(r, c);
+	}
+
+	/* usually whole requests: serve them off the stack, and keep only what
+	 * is left (part of a message, or requests held back) */
+	used = reactor_serve(r, c, data, n);
+	if (used < 0) return -1;
+	if (used < n) {
+		c->in = (char*)malloc(REACTOR_BUFLEN);
+		if (!c->in) return -1;
+		memcpy(c->in, data + used, n - used);
+		c->inlen = n - used;
+	}
+	return reactor_write(r, c);
+}
+
+/**
+ * Serve pending UDP requests.
+ */
+static void reactor_datagram(struct reactor_t *r) {
+	char data[REACTOR_BUFLEN];
+	char reply[REACTOR_REPLYLEN];
+	struct sockaddr_in addr;
+	socklen_t addrlen;
+	int replylen;
+	int n;
+	int i;
+
+	for (i = 0; i < REACTOR_MAXEVENTS; i++) {
+		addrlen = sizeof(addr);
+		n = recvfrom(r->udp_sockfd, data, REACTOR_BUFLEN, 0, (struct sockaddr *)&addr, &addrlen);
+		if (n < 0) break;
+
+		replylen = 0;
+		if (r->handler(data, n, reply, &replylen, NULL) > 0 && replylen > 0) {
+			sendto(r->udp_sockfd, reply, replylen, 0, (struct sockaddr *)&addr, addrlen);
+		}
+	}
+}
+
+/**
+ * Push the current updates to subscribers whose filters let them through.
+ * Subscribers that do not read their updates are dropped.
+ */
+static void reactor_push(struct reactor_t *r) {
+	char update[REACTOR_REPLYLEN];
+	struct conn_t *c;
+	struct conn_t *next;
+	unsigned int pending;
+	uint64_t count;
+	double value;
+	double change;
+	long long now;
+	int topic;
+	int len;
+
+	if (read(r->notify_fd, &count, sizeof(count)) < 0 || !r->push) {
+		return;
+	}
+
+	pending = __atomic_exchange_n(&r->pending, 0, __ATOMIC_ACQ_REL);
+	now = now_msec();
+	for (topic = 0; pending; topic++, pending >>= 1) {
+		if (!(pending & 1)) continue;
+
+		len = r->push(topic, update, &value);
+		for (c = r->subs; c; c = next) {
+			next = c->next;
+			if (c->sub.topic != topic) continue;
+
+			change = value - c->sub.last_value;
+			if (change < 0) change = -change;
+			if (change < c->sub.min_change || now - c->sub.last_push < c->sub.min_interval) {
+				continue;
+			}
+
+			if (len > REACTOR_OUTLEN - c->outlen || conn_queue(c, update, len) < 0) {
+				reactor_drop(r, c);
+				continue;
+			}
+			c->sub.last_value = value;
+			c->sub.last_push = now;
+			if (reactor_flush(r, c) < 0) {
+				reactor_drop(r, c);
+			}
+		}
+	}
+}
+
+/**
+ * Close connections idle for longer than the idle timeout.
+ */
+static void reactor_sweep(struct reactor_t *r) {
+	long long now;
+
+	if (r->idle_timeout <= 0) return;
+
+	now = now_msec();
+	while (r->conns_tail && now - r->conns_tail->last > r->idle_timeout) {
+		reactor_drop(r, r->conns_tail);
+	}
+}
+
+/**
+ * Register a server socket with the reactor.
+ */
+static int reactor_listen(struct reactor_t *r, int *sockfd) {
+	struct epoll_event ev;
+
+	if (set_nonblocking(*sockfd) < 0) {
+		return -1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = sockfd;
+	return epoll_ctl(r->epfd, EPOLL_CTL_ADD, *sockfd, &ev);
+}
+
+/**
+ * Sets up a reactor over already initialized servers (see init_server()).
+ * Either of tcp and udp may be NULL. The reactor takes over the server
+ * sockets and must not be moved in memory after this call.
+ * Returns 0 on success or -1 on error.
+ */
+int reactor_init(struct reactor_t *r, struct cnx_info_t *tcp, struct cnx_info_t *udp, int idle_timeout, msg_handler_t handler, push_handler_t push) {
+	memset(r, 0, sizeof(struct reactor_t));
+	r->tcp_sockfd = -1;
+	r->udp_sockfd = -1;
+	r->idle_timeout = idle_timeout;
+	r->handler = handler;
+	r->push = push;
+
+	r->epfd = epoll_create(REACTOR_MAXEVENTS);
+	if (r->epfd < 0) {
+		return -1;
+	}
+
+	r->notify_fd = eventfd(0, EFD_NONBLOCK);
+	if (r->notify_fd < 0 || reactor_listen(r, &r->notify_fd) < 0) {
+		return -1;
+	}
+
+	if (tcp) {
+		r->tcp_sockfd = tcp->sockfd;
+		if (reactor_listen(r, &r->tcp_sockfd) < 0) return -1;
+	}
+	if (udp) {
+		r->udp_sockfd = udp->sockfd;
+		if (reactor_listen(r, &r->udp_sockfd) < 0) return -1;
+	}
+	return 0;
+}
+
+/**
+ * Waits up to timeout msec for events and serves them: accepts connections,
+ * reads and frames requests, sends replies and closes finished or idle
+ * connections. Returns the number of events served or -1 on error.
+ */
+int reactor_poll(struct reactor_t *r, int timeout) {
+	struct epoll_event events[REACTOR_MAXEVENTS];
+	struct conn_t *c;
+	int notified;
+	int n;
+	int i;
+
+	n = epoll_wait(r->epfd, events, REACTOR_MAXEVENTS, timeout);
+	if (n < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+
+	notified = 0;
+	for (i = 0; i < n; i++) {
+		if (events[i].data.ptr == &r->tcp_sockfd) {
+			reactor_accept(r);
+		}
+		else if (events[i].data.ptr == &r->udp_sockfd) {
+			reactor_datagram(r);
+		}
+		else if (events[i].data.ptr == &r->notify_fd) {
+			/* after the other events: pushing may drop connections */
+			notified = 1;
+		}
+		else {
+			c = (struct conn_t*)events[i].data.ptr;
+			if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				reactor_drop(r, c);
+				continue;
+			}
+			if ((events[i].events & (EPOLLIN | EPOLLRDHUP)) && reactor_read(r, c) < 0) {
+				reactor_drop(r, c);
+				continue;
+			}
+			if ((events[i].events & EPOLLOUT) && reactor_write(r, c) < 0) {
+				reactor_drop(r, c);
+			}
+		}
+	}
+
+	if (notified) {
+		reactor_push(r);
+	}
+	reactor_sweep(r);
+	return n;
+}
+
+/**
+ * Closes all connections, the server sockets and the reactor.
+ */
+void reactor_close(struct reactor_t *r) {
+	while (r->conns) {
+		reactor_drop(r, r->conns);
+	}
+	while (r->subs) {
+		reactor_drop(r, r->subs);
+	}
+	if (r->tcp_sockfd >= 0) close(r->tcp_sockfd);
+	if (r->udp_sockfd >= 0) close(r->udp_sockfd);
+	if (r->notify_fd >= 0) close(r->notify_fd);
+	if (r->epfd >= 0) close(r->epfd);
+	r->tcp_sockfd = r->udp_sockfd = r->notify_fd = r->epfd = -1;
+}
+
+/**
+ * Wakes up the reactor to push an update of topic to subscribers. May be
+ * called from any thread; it costs nothing when there are no subscribers.
+ */
+void reactor_notify(struct reactor_t *r, int topic) {
+	uint64_t one = 1;
+
+	if (__atomic_load_n(&r->nsubs, __ATOMIC_RELAXED) > 0) {
+		__atomic_fetch_or(&r->pending, 1u << topic, __ATOMIC_RELEASE);
+		if (write(r->notify_fd, &one, sizeof(one)) < 0) {
+			/* counter saturated: a wakeup is already pending */
+		}
+	}
+}
+
+/**
+ * Receive datagrams and send replies in batches until the pool is stopped.
+ */
+static void *udp_worker_run(void *arg) {
+	struct udp_worker_t *w = (struct udp_worker_t*)arg;
+	struct udp_pool_t *pool = w->pool;
+	int batch = pool->batch;
+	struct mmsghdr rmsg[batch];
+	struct mmsghdr smsg[batch];
+	struct iovec riov[batch];
+	struct iovec siov[batch];
+	struct sockaddr_in addrs[batch];
+	char *data;
+	char *replies;
+	int replylen;
+	int nreplies;
+	int n;
+	int i;
+
+	data = (char*)malloc(batch * REACTOR_BUFLEN);
+	replies = (char*)malloc(batch * REACTOR_REPLYLEN);
+	if (!data || !replies) {
+		if (data) free(data);
+		if (replies) free(replies);
+		return NULL;
+	}
+
+	memset(rmsg, 0, sizeof(rmsg));
+	memset(smsg, 0, sizeof(smsg));
+	for (i = 0; i < batch; i++) {
+		riov[i].iov_base = data + i * REACTOR_BUFLEN;
+		riov[i].iov_len = REACTOR_BUFLEN;
+		rmsg[i].msg_hdr.msg_iov = &riov[i];
+		rmsg[i].msg_hdr.msg_iovlen = 1;
+		rmsg[i].msg_hdr.msg_name = &addrs[i];
+		smsg[i].msg_hdr.msg_iov = &siov[i];
+		smsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (__atomic_load_n(&pool->running, __ATOMIC_RELAXED)) {
+		for (i = 0; i < batch; i++) {
+			rmsg[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		}
+
+		/* block for the first datagram (or the receive timeout), then take
+		 * whatever else is already queued */
+		n = recvmmsg(w->sockfd, rmsg, batch, MSG_WAITFORONE, NULL);
+		if (n <= 0) continue;
+
+		nreplies = 0;
+		for (i = 0; i < n; i++) {
+			replylen = 0;
+			if (pool->handler(riov[i].iov_base, rmsg[i].msg_len, replies + nreplies * REACTOR_REPLYLEN, &replylen, NULL) > 0 && replylen > 0) {
+				siov[nreplies].iov_base = replies + nreplies * REACTOR_REPLYLEN;
+				siov[nreplies].iov_len = replylen;
+				smsg[nreplies].msg_hdr.msg_name = &addrs[i];
+				smsg[nreplies].msg_hdr.msg_namelen = rmsg[i].msg_hdr.msg_namelen;
+				nreplies++;
+			}
+		}
+
+		for (i = 0; i < nreplies; i += n) {
+			n = sendmmsg(w->sockfd, smsg + i, nreplies - i, 0);
+			if (n < 0) {
+				if (errno == EINTR) {
+					n = 0;
+					continue;
+				}
+				/* drop the reply that could not be sent */
+				n = 1;
+			}
+		}
+	}
+
+	free(data);
+	free(replies);
+	return NULL;
+}
+
+/**
+ * Open a UDP socket bound to the pool address, shared with the other
+ * workers. Receive calls time out every second so that workers notice
+ * when the pool is stopped.
+ */
+static int udp_worker_socket(struct udp_pool_t *pool) {
+	struct timeval tv;
+	int one = 1;
+	int fd;
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	tv.tv_sec = 1;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0
+		|| setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0
+		|| bind(fd, (struct sockaddr *)&pool->addr, sizeof(pool->addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * Starts nworkers threads serving UDP requests on the address and port of
+ * info, each on its own SO_REUSEPORT socket, passing every datagram to
+ * handler. Requests and replies are batched in groups of up to batch
+ * datagrams. info must not be bound by init_server().
+ * Returns 0 on success or -1 on error.
+ */
+int udp_pool_start(struct udp_pool_t *pool, struct cnx_info_t *info, int nworkers, int batch, msg_handler_t handler) {
+	int i;
+
+	memset(pool, 0, sizeof(struct udp_pool_t));
+	if (nworkers < 1 || nworkers > UDPPOOL_MAXWORKERS || batch < 1 || batch > UDPPOOL_MAXBATCH) {
+		return -1;
+	}
+
+	pool->addr.sin_family = AF_INET;
+	if (!inet_aton(info->host, &(pool->addr.sin_addr))) {
+		pool->addr.sin_addr.s_addr = INADDR_ANY;
+	}
+	pool->addr.sin_port = htons(info->port);
+	pool->batch = batch;
+	pool->handler = handler;
+	pool->running = 1;
+
+	pool->workers = (struct udp_worker_t*)malloc(nworkers * sizeof(struct udp_worker_t));
+	if (!pool->workers) {
+		return -1;
+	}
+
+	/* bind all sockets first, so that no datagram reaches a socket that
+	 * is not served yet */
+	for (i = 0; i < nworkers; i++) {
+		pool->workers[i].pool = pool;
+		pool->workers[i].sockfd = udp_worker_socket(pool);
+		if (pool->workers[i].sockfd < 0) {
+			while (--i >= 0) close(pool->workers[i].sockfd);
+			free(pool->workers);
+			pool->workers = NULL;
+			return -1;
+		}
+	}
+
+	for (i = 0; i < nworkers; i++) {
+		if (pthread_create(&pool->workers[i].thread, NULL, udp_worker_run, &pool->workers[i]) != 0) {
+			break;
+		}
+		pool->nworkers++;
+	}
+	for (; i < nworkers; i++) {
+		close(pool->workers[i].sockfd);
+	}
+
+	if (pool->nworkers < nworkers) {
+		udp_pool_stop(pool);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the workers (within a second) and closes their sockets.
+ */
+void udp_pool_stop(struct udp_pool_t *pool) {
+	int i;
+
+	__atomic_store_n(&pool->running, 0, __ATOMIC_RELAXED);
+	for (i = 0; i < pool->nworkers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		close(pool->workers[i].sockfd);
+	}
+	if (pool->workers) free(pool->workers);
+	pool->workers = NULL;
+	pool->nworkers = 0;
+}
@@ -32,9 +32,17 @@
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #define _PROTO_UDP_	1
 #define _PROTO_TCP_	2
+#define _PROTO_BOTH_	(_PROTO_UDP_ | _PROTO_TCP_)
 
 #define FROM_CLIENT	1
 #define TO_SERVER	1
@@ -43,6 +51,17 @@
 
 #define ERR_ACCEPT_ON_UDP	-10
 
+#define REACTOR_MAXEVENTS	64
+/* a request of up to MAX_MESSAGE_LEN bytes must fit (see protocol.h) */
+#define REACTOR_BUFLEN		4160
+#define REACTOR_REPLYLEN	8192
+/* requests are read only while a reply fits */
+#define REACTOR_OUTLEN		(2 * REACTOR_REPLYLEN)
+#define REACTOR_MAXTOPICS	32
+
+#define UDPPOOL_MAXWORKERS	64
+#define UDPPOOL_MAXBATCH	256
+
 struct cnx_info_t {
 	int proto;
 	char host[80];
@@ -53,6 +72,115 @@ struct cnx_info_t {
 	struct sockaddr_in cliaddr;
 };
 
+/**
+ * Subscription of a TCP connection to updates pushed by the reactor (see
+ * reactor_notify()).
+ */
+struct subscription_t {
+	int active;
+	/* updates subscribed to (< REACTOR_MAXTOPICS) */
+	int topic;
+	/* push only if the value changed by at least this much */
+	double min_change;
+	/* push at most once every min_interval ms */
+	int min_interval;
+	/* value and time (ms) of the last push */
+	double last_value;
+	long long last_push;
+};
+
+/**
+ * Message handler used by the reactor. It is passed the data received so far
+ * on a TCP connection, or a whole UDP datagram. Returns the number of bytes
+ * of a complete message it consumed, 0 if more data are needed, or < 0 if the
+ * data are invalid. A reply of up to REACTOR_REPLYLEN bytes may be written to
+ * reply, setting replylen. For TCP connections, sub points to the
+ * subscription of the connection, which the handler may activate; it is NULL
+ * for UDP.
+ */
+typedef int (*msg_handler_t)(char *data, int len, char *reply, int *replylen, struct subscription_t *sub);
+
+/**
+ * Update handler used by the reactor. Writes the update of topic to push to
+ * subscribers (up to REACTOR_REPLYLEN bytes) to reply, sets value for the
+ * subscription filters and returns the update length.
+ */
+typedef int (*push_handler_t)(int topic, char *reply, double *value);
+
+/**
+ * TCP client connection served by the reactor.
+ */
+struct conn_t {
+	int fd;
+	/* data received but not yet consumed (REACTOR_BUFLEN bytes, allocated
+	 * only while there are any) */
+	char *in;
+	int inlen;
+	/* replies not yet sent (REACTOR_OUTLEN bytes, allocated only while
+	 * there are any, or for as long as the connection is subscribed) */
+	char *out;
+	int outlen;
+	/* events waited for: EPOLLOUT while replies are pending, EPOLLIN while
+	 * there is room for another reply */
+	unsigned int events;
+	/* time of last activity (ms) */
+	long long last;
+	struct subscription_t sub;
+	struct conn_t *prev;
+	struct conn_t *next;
+};
+
+/**
+ * Event-driven server for TCP and/or UDP clients.
+ */
+struct reactor_t {
+	int epfd;
+	/* listening sockets, -1 if not used */
+	int tcp_sockfd;
+	int udp_sockfd;
+	/* TCP connections idle for longer than this (ms) are closed */
+	int idle_timeout;
+	msg_handler_t handler;
+	push_handler_t push;
+	/* signaled when there is an update to push */
+	int notify_fd;
+	/* topics with updates to push (bit mask) */
+	unsigned int pending;
+	/* connections, most recently active first */
+	struct conn_t *conns;
+	struct conn_t *conns_tail;
+	int nconns;
+	/* subscribed connections (never idle) */
+	struct conn_t *subs;
+	int nsubs;
+};
+
+struct udp_pool_t;
+
+/**
+ * UDP worker thread with its own socket bound to the shared port.
+ */
+struct udp_worker_t {
+	pthread_t thread;
+	int sockfd;
+	struct udp_pool_t *pool;
+};
+
+/**
+ * Pool of UDP workers. The kernel spreads incoming datagrams over the
+ * worker sockets (SO_REUSEPORT), and each worker receives and replies to
+ * up to batch datagrams per system call.
+ */
+struct udp_pool_t {
+	struct sockaddr_in addr;
+	int nworkers;
+	int batch;
+	msg_handler_t handler;
+	/* cleared to stop the workers */
+	int running;
+	struct udp_worker_t *workers;
+};
+
 /**
  * Initializes a server based on connection information.
  * For a TCP server, it calls socket(), bind() and listen().
@@ -68,6 +196,21 @@ int init_server(struct cnx_info_t* info);
  */
 int init_client_connection(struct cnx_info_t* info);
 
+/**
+ * Sets up a UDP socket for sending datagrams to the multicast group and port
+ * of info with the given TTL (see write_data()). Multicast loopback is
+ * enabled so that local receivers get the datagrams too.
+ * Returns the socket descriptor or < 0 on error.
+ */
+int init_multicast_sender(struct cnx_info_t *info, int ttl);
+
+/**
+ * Sets up a UDP socket receiving datagrams sent to the multicast group and
+ * port of info (see read_data()). Several receivers may share the port.
+ * Returns the socket descriptor or < 0 on error.
+ */
+int init_multicast_receiver(struct cnx_info_t *info);
+
 /**
  * Calls accept() on a TCP server socket and returns the client socket
  * or returns ERR_ACCEPT_ON_UPD
@@ -97,5 +240,46 @@ int peek_data(struct cnx_info_t *info, void *data, int peek_data_len, int timeou
  */
 int wait_for_data(struct cnx_info_t* info, int msec, int from_client);
 
+/**
+ * Sets up a reactor over already initialized servers (see init_server()).
+ * Either of tcp and udp may be NULL. Updates are pushed to subscribed
+ * connections through push, if not NULL. The reactor takes over the server
+ * sockets and must not be moved in memory after this call.
+ * Returns 0 on success or -1 on error.
+ */
+int reactor_init(struct reactor_t *r, struct cnx_info_t *tcp, struct cnx_info_t *udp, int idle_timeout, msg_handler_t handler, push_handler_t push);
+
+/**
+ * Waits up to timeout msec for events and serves them: accepts connections,
+ * reads and frames requests, sends replies and closes finished or idle
+ * connections. Returns the number of events served or -1 on error.
+ */
+int reactor_poll(struct reactor_t *r, int timeout);
+
+/**
+ * Closes all connections, the server sockets and the reactor.
+ */
+void reactor_close(struct reactor_t *r);
+
+/**
+ * Wakes up the reactor to push an update of topic to subscribers. May be
+ * called from any thread; it costs nothing when there are no subscribers.
+ */
+void reactor_notify(struct reactor_t *r, int topic);
+
+/**
+ * Starts nworkers threads serving UDP requests on the address and port of
+ * info, each on its own SO_REUSEPORT socket, passing every datagram to
+ * handler. Requests and replies are batched in groups of up to batch
+ * datagrams. info must not be bound by init_server().
+ * Returns 0 on success or -1 on error.
+ */
+int udp_pool_start(struct udp_pool_t *pool, struct cnx_info_t *info, int nworkers, int batch, msg_handler_t handler);
+
+/**
+ * Stops the workers (within a second) and closes their sockets.
+ */
+void udp_pool_stop(struct udp_pool_t *pool);
+
 #endif
 
@@ -0,0 +1,95 @@
+/**
+ * pipetrace.c -- Per-stage latency tracing of the sample pipeline of a path.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "pipetrace.h"
+
+/* stages reported: time from boundary from[i] to boundary to[i] */
+#define PIPETRACE_NREPORTED	6
+static const int pipetrace_from[PIPETRACE_NREPORTED] = {0, 1, 2, 3, 3, 0};
+static const int pipetrace_to[PIPETRACE_NREPORTED] = {1, 2, 3, 4, 5, 4};
+static const char *pipetrace_names[PIPETRACE_NREPORTED] = {
+	"parse", "estimate", "publish", "log", "serve", "total"
+};
+
+static int pipetrace_cmp(const void *a, const void *b) {
+	long long x = *(const long long*)a;
+	long long y = *(const long long*)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Write the percentiles of the time spent in each stage over the lines in
+ * the ring, and the ring itself (oldest line first), to f. Lines being
+ * traced meanwhile may be reported inconsistently.
+ */
+void pipetrace_dump(struct pipetrace_t *t, char *name, FILE *f) {
+	struct pipetrace_rec_t *ring;
+	struct pipetrace_rec_t *rec;
+	long long *d;
+	long long sum;
+	unsigned int n = __atomic_load_n(&t->n, __ATOMIC_ACQUIRE);
+	unsigned int first = n > PIPETRACE_LEN ? n - PIPETRACE_LEN : 0;
+	unsigned int i;
+	int nd;
+	int s, j;
+
+	ring = (struct pipetrace_rec_t*)malloc(PIPETRACE_LEN * sizeof(struct pipetrace_rec_t));
+	d = (long long*)malloc(PIPETRACE_LEN * sizeof(long long));
+	if (!ring || !d) {
+		free(ring);
+		free(d);
+		return;
+	}
+	memcpy(ring, t->ring, PIPETRACE_LEN * sizeof(struct pipetrace_rec_t));
+
+	fprintf(f, "Path: %s\nLines: %u (last %u traced)\n", name, n, n - first);
+	fprintf(f, "%-10s %8s %10s %10s %10s %10s %10s (usec)\n", "stage", "lines", "p50", "p90", "p99", "max", "avg");
+	for (s = 0; s < PIPETRACE_NREPORTED; s++) {
+		nd = 0;
+		for (i = first; i != n; i++) {
+			rec = &ring[i & (PIPETRACE_LEN - 1)];
+			if (rec->t[pipetrace_from[s]] && rec->t[pipetrace_to[s]] >= rec->t[pipetrace_from[s]]) {
+				d[nd++] = rec->t[pipetrace_to[s]] - rec->t[pipetrace_from[s]];
+			}
+		}
+		if (!nd) {
+			fprintf(f, "%-10s %8d\n", pipetrace_names[s], 0);
+			continue;
+		}
+		qsort(d, nd, sizeof(long long), pipetrace_cmp);
+		for (sum = 0, j = 0; j < nd; j++) sum += d[j];
+		fprintf(f, "%-10s %8d %10.3f %10.3f %10.3f %10.3f %10.3f\n", pipetrace_names[s], nd, d[nd / 2] / 1e3,
+			d[(int)(nd * 0.9)] / 1e3, d[(int)(nd * 0.99)] / 1e3, d[nd - 1] / 1e3, (double)sum / nd / 1e3);
+	}
+
+	fprintf(f, "\n# read parse estimate publish log serve (nsec, monotonic clock; 0: not reached)\n");
+	for (i = first; i != n; i++) {
+		rec = &ring[i & (PIPETRACE_LEN - 1)];
+		fprintf(f, "%lld", rec->t[0]);
+		for (s = 1; s < PIPETRACE_NSTAGES; s++) {
+			fprintf(f, " %lld", rec->t[s]);
+		}
+		fprintf(f, "\n");
+	}
+	fprintf(f, "\n");
+
+	free(ring);
+	free(d);
+}
@@ -0,0 +1,114 @@
+/**
+ * pipetrace.h -- Per-stage latency tracing of the sample pipeline of a path.
+ * The device thread stamps each line with the monotonic clock as it passes
+ * the stage boundaries, into a ring of the last PIPETRACE_LEN lines; request
+ * handlers stamp the first reply carrying each new estimate. A stamp is a
+ * clock_gettime() call (vDSO) and a store, so tracing is always on.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _PIPETRACE_H_
+#define _PIPETRACE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+/* lines traced (power of 2) */
+#define PIPETRACE_LEN		4096
+
+/* stage boundaries */
+#define PIPETRACE_READ		0 /* line read from the device */
+#define PIPETRACE_PARSE		1 /* line parsed */
+#define PIPETRACE_ESTIMATE	2 /* load estimated */
+#define PIPETRACE_PUBLISH	3 /* LRSP rendered and published */
+#define PIPETRACE_LOG		4 /* sample queued to the output file */
+#define PIPETRACE_SERVE		5 /* first reply with the new estimate sent */
+#define PIPETRACE_NSTAGES	6
+
+/**
+ * Stage boundary times of a line (nsec on the monotonic clock, 0: not
+ * reached).
+ */
+struct pipetrace_rec_t {
+	long long t[PIPETRACE_NSTAGES];
+};
+
+struct pipetrace_t {
+	struct pipetrace_rec_t ring[PIPETRACE_LEN];
+	/* lines started; ring[(n - 1) % PIPETRACE_LEN] is the current one */
+	unsigned int n;
+	/* line of the last estimate published, and of the last one served */
+	unsigned int published;
+	unsigned int served;
+};
+
+/**
+ * Current time on the monotonic clock (nsec).
+ */
+static inline long long pipetrace_now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Start tracing a line just read (device thread).
+ */
+static inline void pipetrace_begin(struct pipetrace_t *t) {
+	struct pipetrace_rec_t *rec = &t->ring[t->n & (PIPETRACE_LEN - 1)];
+
+	memset(rec, 0, sizeof(struct pipetrace_rec_t));
+	rec->t[PIPETRACE_READ] = pipetrace_now();
+	__atomic_store_n(&t->n, t->n + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record that the current line reached a stage (device thread).
+ */
+static inline void pipetrace_stamp(struct pipetrace_t *t, int stage) {
+	t->ring[(t->n - 1) & (PIPETRACE_LEN - 1)].t[stage] = pipetrace_now();
+	if (stage == PIPETRACE_PUBLISH) {
+		__atomic_store_n(&t->published, t->n, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * Record that the last estimate published is being sent to a client, if it
+ * is the first time (any thread).
+ */
+static inline void pipetrace_served(struct pipetrace_t *t) {
+	unsigned int published = __atomic_load_n(&t->published, __ATOMIC_ACQUIRE);
+	unsigned int served = __atomic_load_n(&t->served, __ATOMIC_RELAXED);
+
+	if (published != served
+		&& __atomic_compare_exchange_n(&t->served, &served, published, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+		t->ring[(published - 1) & (PIPETRACE_LEN - 1)].t[PIPETRACE_SERVE] = pipetrace_now();
+	}
+}
+
+/**
+ * Write the percentiles of the time spent in each stage over the lines in
+ * the ring, and the ring itself (oldest line first), to f. Lines being
+ * traced meanwhile may be reported inconsistently.
+ */
+void pipetrace_dump(struct pipetrace_t *t, char *name, FILE *f);
+
+#endif
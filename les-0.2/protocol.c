@@ -22,6 +22,47 @@
 #include "protocol.h"
 #include "netfunc.h"
 
+/* little-endian encoding of binary message fields */
+static void lb_put16(char *p, unsigned int v) {
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void lb_put32(char *p, unsigned int v) {
+	lb_put16(p, v & 0xffff);
+	lb_put16(p + 2, v >> 16);
+}
+
+static void lb_put64(char *p, unsigned long long v) {
+	lb_put32(p, v & 0xffffffff);
+	lb_put32(p + 4, v >> 32);
+}
+
+static void lb_putdouble(char *p, double v) {
+	unsigned long long u;
+	memcpy(&u, &v, sizeof(u));
+	lb_put64(p, u);
+}
+
+static unsigned int lb_get16(char *p) {
+	return (unsigned char)p[0] | ((unsigned char)p[1] << 8);
+}
+
+static unsigned int lb_get32(char *p) {
+	return lb_get16(p) | (lb_get16(p + 2) << 16);
+}
+
+static unsigned long long lb_get64(char *p) {
+	return lb_get32(p) | ((unsigned long long)lb_get32(p + 4) << 32);
+}
+
+static double lb_getdouble(char *p) {
+	unsigned long long u = lb_get64(p);
+	double v;
+	memcpy(&v, &u, sizeof(v));
+	return v;
+}
+
 /**
  * Converts the message body to lower case
  */
@@ -100,6 +141,79 @@ char *recv_protocol_message(struct cnx_info_t *info, int *mtype, int timeout, in
 	return message;
 }
 
+/**
+ * Check whether data (len bytes) start with a complete protocol message.
+ * Returns the message size and sets mtype, 0 if more data are needed, or -1
+ * if the data are not a valid message.
+ */
+int frame_protocol_message(char *data, int len, int *mtype) {
+	static const char clhdr[] = "\r\ncontent-length:";
+	int clhdr_len = strlen(clhdr);
+	int clen = 0;
+	int digits = 0;
+	int i;
+
+	/* message type */
+	if (len < 4) {
+		if (strncasecmp(data, LREQ_HDR, len) && strncasecmp(data, LRSP_HDR, len) && strncasecmp(data, SUBS_HDR, len)
+			&& strncasecmp(data, HREQ_HDR, len) && strncasecmp(data, HRSP_HDR, len)
+			&& strncmp(data, LBREQ_HDR, len) && strncmp(data, LBRSP_HDR, len)) return -1;
+		return 0;
+	}
+	if (!strncmp(data, LBREQ_HDR, 4) || !strncmp(data, LBRSP_HDR, 4)) {
+		/* binary message: fixed size header with the total length (the
+		 * magics differ in their last byte only) */
+		*mtype = !strncmp(data, LBREQ_HDR, 4) ? MTYPE_LBREQ : MTYPE_LBRSP;
+		if (len < LB_HDR_LEN) return 0;
+		clen = lb_get16(data + 6);
+		if (clen < LB_HDR_LEN || clen > MAX_CONTENT_LEN) return -1;
+		if (len < clen) return 0;
+		return clen;
+	}
+	if (!strncasecmp(data, LREQ_HDR, 4)) {
+		*mtype = MTYPE_LREQ;
+	}
+	else if (!strncasecmp(data, LRSP_HDR, 4)) {
+		*mtype = MTYPE_LRSP;
+	}
+	else if (!strncasecmp(data, SUBS_HDR, 4)) {
+		*mtype = MTYPE_SUBS;
+	}
+	else if (!strncasecmp(data, HREQ_HDR, 4)) {
+		*mtype = MTYPE_HREQ;
+	}
+	else if (!strncasecmp(data, HRSP_HDR, 4)) {
+		*mtype = MTYPE_HRSP;
+	}
+	else {
+		return -1;
+	}
+
+	/* content length header */
+	for (i = 4; i < len && i < 4 + clhdr_len; i++) {
+		if (tolower((unsigned char)data[i]) != clhdr[i - 4]) return -1;
+	}
+	if (i < 4 + clhdr_len) return 0;
+
+	while (i < len && data[i] == ' ') i++;
+	while (i < len && isdigit((unsigned char)data[i])) {
+		clen = 10 * clen + (data[i] - '0');
+		if (clen > MAX_CONTENT_LEN) return -1;
+		digits++;
+		i++;
+	}
+	if (i + 2 > MAX_HEADER_LEN) return -1;
+	if (i < len && data[i] != '\r') return -1;
+	if (i + 1 < len && data[i + 1] != '\n') return -1;
+	if (i + 2 > len) return 0;
+	if (!digits) return -1;
+
+	/* header, then content */
+	i += 2;
+	if (len < i + clen) return 0;
+	return i + clen;
+}
+
 /**
  * Just call the lower-level write_data method to send a message.
  */
@@ -118,6 +232,59 @@ char *generate_load_request() {
 	return retval;
 }
 
+/**
+ * Format an LREQ message for the given path (NULL: default) into buf (of size
+ * bytes) and return its length.
+ */
+int render_load_request(char *path, char *buf, int size) {
+	char body[LRSP_MAXLEN];
+	int clen = 0;
+	int mlen;
+
+	if (path) {
+		clen = snprintf(body, LRSP_MAXLEN, "Path: %s\r\n", path);
+	}
+	mlen = snprintf(buf, size, LREQ_HDR"\r\nContent-Length: %d\r\n%s", clen, path ? body : "");
+	if (mlen >= size) mlen = size - 1;
+	return mlen;
+}
+
+/**
+ * Copy the path named in an LREQ, SUBS or HREQ message of len bytes to path (of
+ * size bytes), or an empty string if there is none. Returns 0 on success or
+ * -1 if the name does not fit.
+ */
+int parse_request_path(char *message, int len, char *path, int size) {
+	char *line = message;
+	char *end = message + len;
+	char *eol;
+	int n;
+
+	*path = '\0';
+
+	/* skip the type and content length lines */
+	for (n = 0; n < 2 && line < end; n++) {
+		eol = memchr(line, '\n', end - line);
+		line = eol ? eol + 1 : end;
+	}
+
+	for (; line < end; line = eol + 1) {
+		eol = memchr(line, '\n', end - line);
+		if (!eol) eol = end;
+		if (eol - line > 5 && !strncasecmp(line, "path:", 5)) {
+			line += 5;
+			while (line < eol && *line == ' ') line++;
+			n = eol - line;
+			if (n > 0 && line[n - 1] == '\r') n--;
+			if (n >= size) return -1;
+			memcpy(path, line, n);
+			path[n] = '\0';
+			return 0;
+		}
+	}
+	return 0;
+}
+
 /**
  * Parses a load request: Assumes an LREQ message with zero content len.
  */
@@ -134,62 +301,48 @@ int parse_load_request(char *message) {
 }
 
 /**
- * Generate an LREQ message.
+ * Format an LRSP message for linfo into buf (of size bytes). Returns the
+ * message length.
  */
-char *generate_load_response(struct load_info_t *linfo) {
-	int mlen;
+int render_load_response(struct load_info_t *linfo, char *path, char *buf, int size) {
+	static const char *pct_names[LRSP_NPCT] = LRSP_PCT_NAMES;
+	char body[LRSP_MAXLEN];
 	int clen;
-	int pos;
-	char *retval;
-	char str_delay_avg[32];
-
-	mlen = 0;
-	clen = 0;
-
-	mlen += strlen(LRSP_HDR"\r\nContent-length: \r\n"); /* clen will be added at the end */
-	mlen += strlen("Status: ");
-	mlen += strlen("Delay-avg: ");
-	mlen += strlen("Delay-min: ");
-	mlen += strlen("Delay-max: ");
-	mlen += strlen("Samples: ");
-	mlen += strlen("Load-type: ");
-
-	clen += strlen("Status: ");
-	clen += strlen("Delay-avg: ");
-	clen += strlen("Delay-min: ");
-	clen += strlen("Delay-max: ");
-	clen += strlen("Samples: ");
-	clen += strlen("Load-type: ");
-
-	memset(str_delay_avg, 0, 32);
-	sprintf(str_delay_avg, "%f", linfo->weighted_avg);
-
-	mlen += (int)(linfo->status?log10(linfo->status):0) + 3;
-	mlen += strlen(str_delay_avg) + 2;
-	mlen += (int)(linfo->min?log10l(linfo->min):0) + 3;
-	mlen += (int)(linfo->max?log10l(linfo->max):0) + 3;
-	mlen += (int)(linfo->nsamples?log10l(linfo->nsamples):0) + 3;
-	mlen += 7; //load type is a floating point num with 3 decimal dgts: X.XXX
-
-	clen += (int)(linfo->status?log10(linfo->status):0) + 3;
-	clen += strlen(str_delay_avg) + 2;
-	clen += (int)(linfo->min?log10l(linfo->min):0) + 3;
-	clen += (int)(linfo->max?log10l(linfo->max):0) + 3;
-	clen += (int)(linfo->nsamples?log10l(linfo->nsamples):0) + 3;
-	clen += 7; //load type is a floating point num with 3 decimal dgts: X.XXX
-
-	mlen += (int)log10(clen) + 1; /* content-length digits */
-
-	retval = (char *)malloc(mlen + 1);
-	memset(retval, 0, mlen + 1);
+	int mlen;
+	int i;
 
 	double theload = linfo->load_type;
 	if (linfo->load_type < 0) theload = 0.0;
 
-	sprintf(
-		retval, 
-		LRSP_HDR"\r\nContent-Length: %d\r\nStatus: %d\r\nDelay-avg: %s\r\nDelay-min: %lld\r\nDelay-max: %lld\r\nSamples: %d\r\nLoad-type: %1.3f\r\n",
-		clen, linfo->status, str_delay_avg, linfo->min, linfo->max, linfo->nsamples, theload);
+	clen = snprintf(
+		body, LRSP_MAXLEN,
+		"Status: %d\r\nDelay-avg: %f\r\nDelay-min: %lld\r\nDelay-max: %lld\r\nSamples: %d\r\nLoad-type: %1.3f\r\n",
+		linfo->status, linfo->weighted_avg, linfo->min, linfo->max, linfo->nsamples, theload);
+	if (path && clen < LRSP_MAXLEN) {
+		clen += snprintf(body + clen, LRSP_MAXLEN - clen, "Path: %s\r\n", path);
+	}
+	for (i = 0; i < LRSP_NPCT && linfo->pct[i] && clen < LRSP_MAXLEN; i++) {
+		clen += snprintf(body + clen, LRSP_MAXLEN - clen, "Delay-%s: %lld\r\n", pct_names[i], linfo->pct[i]);
+	}
+	for (i = 0; i < LRSP_NPCT && linfo->pct_all[i] && clen < LRSP_MAXLEN; i++) {
+		clen += snprintf(body + clen, LRSP_MAXLEN - clen, "Delay-%s-all: %lld\r\n", pct_names[i], linfo->pct_all[i]);
+	}
+	if (clen >= LRSP_MAXLEN) clen = LRSP_MAXLEN - 1;
+
+	mlen = snprintf(buf, size, LRSP_HDR"\r\nContent-Length: %d\r\n%s", clen, body);
+	if (mlen >= size) mlen = size - 1;
+	return mlen;
+}
+
+/**
+ * Generate an LRSP message.
+ */
+char *generate_load_response(struct load_info_t *linfo) {
+	char *retval;
+
+	retval = (char *)malloc(LRSP_MAXLEN);
+	memset(retval, 0, LRSP_MAXLEN);
+	render_load_response(linfo, NULL, retval, LRSP_MAXLEN);
 
 	return retval;
 }
@@ -198,7 +351,11 @@ char *generate_load_response(struct load_info_t *linfo) {
  * Parse an LRSP message and return load information.
  */
 struct load_info_t *parse_load_response(char *message) {
+	static const char *pct_names[LRSP_NPCT] = LRSP_PCT_NAMES;
+	char name[32];
+	char *line;
 	int clen;
+	int i;
 	char *lmessage;
 	struct load_info_t *retval;
 
@@ -230,6 +387,234 @@ struct load_info_t *parse_load_response(char *message) {
 		return NULL;
 	}
 
+	/* optional delay percentiles */
+	for (i = 0; i < LRSP_NPCT; i++) {
+		snprintf(name, sizeof(name), "\r\ndelay-%s:", pct_names[i]);
+		line = strstr(lmessage, name);
+		if (line) retval->pct[i] = strtoll(line + strlen(name), NULL, 10);
+		snprintf(name, sizeof(name), "\r\ndelay-%s-all:", pct_names[i]);
+		line = strstr(lmessage, name);
+		if (line) retval->pct_all[i] = strtoll(line + strlen(name), NULL, 10);
+	}
+	free(lmessage);
+
 	return retval;
 }
 
+/**
+ * Format a SUBS message with the given filters (0: no filter) into buf (of
+ * size bytes) and return its length.
+ */
+int render_subscribe_request(double min_change, int min_interval, char *buf, int size) {
+	char body[128];
+	int clen;
+	int mlen;
+
+	clen = snprintf(body, sizeof(body), "Min-change: %f\r\nMin-interval: %d\r\n", min_change, min_interval);
+	mlen = snprintf(buf, size, SUBS_HDR"\r\nContent-Length: %d\r\n%s", clen, body);
+	if (mlen >= size) mlen = size - 1;
+	return mlen;
+}
+
+/**
+ * Parse the filters of a SUBS message of len bytes. Filters not present are
+ * set to 0. Returns 0 on success or -1 if the message is not valid.
+ */
+int parse_subscribe_request(char *message, int len, double *min_change, int *min_interval) {
+	char copy[len + 1];
+	char *line;
+	char *end;
+
+	*min_change = 0.0;
+	*min_interval = 0;
+
+	if (len < 4 || strncasecmp(message, SUBS_HDR, 4)) {
+		return -1;
+	}
+	memcpy(copy, message, len);
+	copy[len] = '\0';
+
+	/* skip the type and content length lines */
+	line = strstr(copy, "\r\n");
+	if (line) line = strstr(line + 2, "\r\n");
+
+	while (line && *(line += 2)) {
+		if (!strncasecmp(line, "min-change:", 11)) {
+			*min_change = strtod(line + 11, &end);
+			if (end == line + 11 || *min_change < 0) return -1;
+		}
+		else if (!strncasecmp(line, "min-interval:", 13)) {
+			*min_interval = strtol(line + 13, &end, 10);
+			if (end == line + 13 || *min_interval < 0) return -1;
+		}
+		line = strstr(line, "\r\n");
+	}
+	return 0;
+}
+
+/**
+ * Format an HREQ message into buf (of size bytes) and return its length. The
+ * path is left out if NULL.
+ */
+int render_history_request(char *path, long long from, long long to, int res, char *buf, int size) {
+	char body[LRSP_MAXLEN];
+	int clen = 0;
+	int mlen;
+
+	if (path) {
+		clen = snprintf(body, sizeof(body), "Path: %s\r\n", path);
+	}
+	clen += snprintf(body + clen, sizeof(body) - clen, "From: %.6f\r\nTo: %.6f\r\nResolution: %d\r\n",
+		from / 1e6, to / 1e6, res);
+	mlen = snprintf(buf, size, HREQ_HDR"\r\nContent-Length: %d\r\n%s", clen, body);
+	if (mlen >= size) mlen = size - 1;
+	return mlen;
+}
+
+/**
+ * Parse the range and resolution of an HREQ message of len bytes (see
+ * HREQ_HDR). Returns 0 on success or -1 if the message is not valid.
+ */
+int parse_history_request(char *message, int len, long long *from, long long *to, int *res) {
+	char copy[len + 1];
+	char *line;
+	char *end;
+	double t;
+
+	*from = (long long)HREQ_DEF_FROM * 1000000;
+	*to = 0;
+	*res = HREQ_DEF_RES;
+
+	if (len < 4 || strncasecmp(message, HREQ_HDR, 4)) {
+		return -1;
+	}
+	memcpy(copy, message, len);
+	copy[len] = '\0';
+
+	/* skip the type and content length lines */
+	line = strstr(copy, "\r\n");
+	if (line) line = strstr(line + 2, "\r\n");
+
+	while (line && *(line += 2)) {
+		if (!strncasecmp(line, "from:", 5)) {
+			t = strtod(line + 5, &end);
+			if (end == line + 5) return -1;
+			*from = (long long)(t * 1000000);
+		}
+		else if (!strncasecmp(line, "to:", 3)) {
+			t = strtod(line + 3, &end);
+			if (end == line + 3) return -1;
+			*to = (long long)(t * 1000000);
+		}
+		else if (!strncasecmp(line, "resolution:", 11)) {
+			*res = strtol(line + 11, &end, 10);
+			if (end == line + 11 || *res < 0) return -1;
+		}
+		line = strstr(line, "\r\n");
+	}
+	return 0;
+}
+
+/**
+ * Format an HRSP message with n buckets into buf (of size bytes) and return
+ * its length. The path name is reported if not NULL, and next if not 0.
+ */
+int render_history_response(int status, char *path, int res, struct history_bucket_t *buckets, int n, long long next,
+	char *buf, int size) {
+	char body[LRSP_MAXLEN + HRSP_MAXBUCKETS * HRSP_LINELEN];
+	struct history_bucket_t *b;
+	int clen;
+	int mlen;
+	int len;
+	int i;
+
+	clen = snprintf(body, LRSP_MAXLEN, "Status: %d\r\n", status);
+	if (path) {
+		clen += snprintf(body + clen, LRSP_MAXLEN - clen, "Path: %s\r\n", path);
+	}
+	clen += snprintf(body + clen, LRSP_MAXLEN - clen, "Resolution: %d\r\nBuckets: %d\r\n", res, n);
+	if (next) {
+		clen += snprintf(body + clen, LRSP_MAXLEN - clen, "Next: %Ld.%06d\r\n", next / 1000000,
+			(int)(next % 1000000));
+	}
+	for (i = 0; i < n && i < HRSP_MAXBUCKETS; i++) {
+		b = &buckets[i];
+		len = snprintf(body + clen, HRSP_LINELEN, "%Ld.%03d %u %f %f %f %f\r\n", b->start / 1000000,
+			(int)(b->start % 1000000 / 1000), b->count, b->min, b->max, b->sum / b->count, b->last);
+		clen += len < HRSP_LINELEN ? len : HRSP_LINELEN - 1;
+	}
+	mlen = snprintf(buf, size, HRSP_HDR"\r\nContent-Length: %d\r\n%s", clen, body);
+	if (mlen >= size) mlen = size - 1;
+	return mlen;
+}
+
+/**
+ * Format a binary LREQ message for a path index into buf (at least
+ * LBREQ_PATH_LEN bytes) and return its length. The index is left out for
+ * the default path.
+ */
+int render_load_request_bin(unsigned int path, char *buf) {
+	int len = path ? LBREQ_PATH_LEN : LBREQ_LEN;
+
+	memcpy(buf, LBREQ_HDR, 4);
+	lb_put16(buf + 4, LB_VERSION);
+	lb_put16(buf + 6, len);
+	if (path) lb_put32(buf + 8, path);
+	return len;
+}
+
+/**
+ * Return the path index requested by a binary LREQ message of len bytes (0 if
+ * there is none, LB_ALLPATHS for all paths).
+ */
+unsigned int parse_load_request_bin(char *data, int len) {
+	if (len < LBREQ_PATH_LEN || lb_get16(data + 6) < LBREQ_PATH_LEN) {
+		return 0;
+	}
+	return lb_get32(data + 8);
+}
+
+/**
+ * Format a binary LRSP message for linfo into buf (at least LBRSP_LEN bytes)
+ * and return its length.
+ */
+int render_load_response_bin(struct load_info_t *linfo, char *buf) {
+	double theload = linfo->load_type;
+	if (linfo->load_type < 0) theload = 0.0;
+
+	memcpy(buf, LBRSP_HDR, 4);
+	lb_put16(buf + 4, LB_VERSION);
+	lb_put16(buf + 6, LBRSP_LEN);
+	lb_put32(buf + 8, linfo->seq);
+	lb_put32(buf + 12, linfo->status);
+	lb_put32(buf + 16, linfo->nsamples);
+	lb_put32(buf + 20, linfo->path);
+	lb_put64(buf + 24, linfo->min);
+	lb_put64(buf + 32, linfo->max);
+	lb_put64(buf + 40, linfo->timestamp);
+	lb_putdouble(buf + 48, linfo->weighted_avg);
+	lb_putdouble(buf + 56, theload);
+	return LBRSP_LEN;
+}
+
+/**
+ * Parse a binary LRSP message of len bytes into linfo. Returns 0 on success
+ * or -1 if the message is not valid.
+ */
+int parse_load_response_bin(char *data, int len, struct load_info_t *linfo) {
+	if (len < LBRSP_LEN || strncmp(data, LBRSP_HDR, 4) || lb_get16(data + 6) < LBRSP_LEN) {
+		return -1;
+	}
+
+	memset(linfo, 0, sizeof(struct load_info_t));
+	linfo->seq = lb_get32(data + 8);
+	linfo->status = (int)lb_get32(data + 12);
+	linfo->nsamples = (int)lb_get32(data + 16);
+	linfo->path = (int)lb_get32(data + 20);
+	linfo->min = (long long)lb_get64(data + 24);
+	linfo->max = (long long)lb_get64(data + 32);
+	linfo->timestamp = (long long)lb_get64(data + 40);
+	linfo->weighted_avg = lb_getdouble(data + 48);
+	linfo->load_type = lb_getdouble(data + 56);
+	return 0;
+}
@@ -31,15 +31,110 @@
 
 #include "netfunc.h"
 #include "b64.h"
+#include "history.h"
 
 #define PEEK_DATA_LEN 30
 
 #define MTYPE_LREQ				10
 #define MTYPE_LRSP				20
+#define MTYPE_LBREQ				11
+#define MTYPE_LBRSP				21
+#define MTYPE_SUBS				30
+#define MTYPE_HREQ				12
+#define MTYPE_HRSP				22
 
 #define LREQ_HDR "LREQ"
 #define LRSP_HDR "LRSP"
 
+/**
+ * LREQ (and SUBS) may name the path to report in a "Path:" content line
+ * ("*" in LREQ for all paths, each in its own LRSP message). LRSP messages
+ * then report the path in a "Path:" line after the load.
+ */
+#define PATH_ALL "*"
+
+/**
+ * SUBS subscribes a TCP client to LRSP messages pushed on every load update.
+ * Optional content lines filter updates:
+ *   Min-change: push only if the load changed by at least this much
+ *   Min-interval: push at most once every this many msec
+ */
+#define SUBS_HDR "SUBS"
+
+/**
+ * HREQ asks for the load history of a path over a time range. Content lines:
+ *   Path: path name (default: the first path)
+ *   From: start of the range (default: -3600)
+ *   To: end of the range (default: 0)
+ *   Resolution: bucket length in seconds; the coarsest rollup not longer than
+ *     this is used, 0 for raw samples (default: 60)
+ * Times are seconds since the epoch, or relative to now if not positive
+ * (functions below take them in usec).
+ * The HRSP answer has Status, Path (if any), Resolution and Buckets lines,
+ * followed by a "start count min max mean last" line per bucket, oldest
+ * first. If the buckets do not fit in a message, a Next line gives the From
+ * of a follow-up request for the rest.
+ */
+#define HREQ_HDR "HREQ"
+#define HRSP_HDR "HRSP"
+#define HREQ_DEF_FROM			-3600
+#define HREQ_DEF_RES			60
+
+/* max bucket line length and buckets per HRSP message */
+#define HRSP_LINELEN			80
+#define HRSP_MAXBUCKETS			48
+
+/**
+ * Binary variant of LREQ/LRSP. Messages start with a magic (LBREQ_HDR or
+ * LBRSP_HDR), followed by the protocol version and the total message length
+ * (16 bits each). Integers are little-endian, floating point values are
+ * little-endian IEEE 754 doubles. An LBREQ may be followed by a 32-bit path
+ * index (LB_ALLPATHS for all paths). LBRSP layout:
+ *
+ *   0 magic		 4 version	 6 length	 8 seq
+ *  12 status		16 samples	20 path		24 delay-min
+ *  32 delay-max	40 timestamp	48 delay-avg	56 load-type
+ */
+#define LBREQ_HDR "LBRQ"
+#define LBRSP_HDR "LBRS"
+#define LB_VERSION				1
+#define LB_HDR_LEN				8
+#define LBREQ_LEN				8
+#define LBREQ_PATH_LEN			12
+#define LB_ALLPATHS				0xffffffff
+
+/* max number of paths (devices) a LES instance monitors and reports */
+#define LES_MAXPATHS			16
+#define LBRSP_LEN				64
+
+/**
+ * Multicast updates (binary LRSP messages) go by default to the server port
+ * plus this offset, so that receivers on the LES host can bind it while the
+ * server's UDP socket holds its own port.
+ */
+#define MCAST_PORT_OFFSET		1
+
+/* max content length accepted in a message, and max header length */
+#define MAX_CONTENT_LEN			4096
+#define MAX_HEADER_LEN			64
+#define MAX_MESSAGE_LEN			(MAX_HEADER_LEN + MAX_CONTENT_LEN)
+
+#if MAX_MESSAGE_LEN > REACTOR_BUFLEN
+#error "REACTOR_BUFLEN too small for MAX_MESSAGE_LEN"
+#endif
+
+/* max length of an LRSP message */
+#define LRSP_MAXLEN				384
+
+/**
+ * Delay percentiles reported in optional LRSP lines: Delay-p50 etc. over
+ * the sliding horizon (see the pctwindow option), Delay-p50-all etc. over
+ * the lifetime of the service.
+ */
+#define LRSP_NPCT				3
+#define LRSP_PCT				{0.5, 0.9, 0.99}
+#define LRSP_PCT_NAMES			{"p50", "p90", "p99"}
+
 #define STATUS_OK				200
 #define STATUS_DEV_UNAVAIL		400
 #define STATUS_GEN_ERR			444
@@ -52,6 +147,8 @@
  * Delay/load statistics and information
  */
 struct load_info_t {
+	unsigned int seq; //incremented on every update
+	long long timestamp; //time of the last sample (usec since the epoch)
 	int status; //server/response status
 	int nsamples;
 	long long sample_sum;
@@ -60,6 +157,9 @@ struct load_info_t {
 	long long min;
 	long long max;
 	double load_type;
+	int path; //path index (multi-device mode)
+	long long pct[LRSP_NPCT]; //delay percentiles, sliding horizon (0: none)
+	long long pct_all[LRSP_NPCT]; //delay percentiles, lifetime (0: none)
 };
 
 /**
@@ -68,6 +168,13 @@ struct load_info_t {
  */
 char *recv_protocol_message(struct cnx_info_t *info, int *mtype, int timeout, int from_client);
 
+/**
+ * Check whether data (len bytes) start with a complete protocol message.
+ * Returns the message size and sets mtype, 0 if more data are needed, or -1
+ * if the data are not a valid message.
+ */
+int frame_protocol_message(char *data, int len, int *mtype);
+
 /**
  * Just call the lower-level write_data method to send a message.
  */
@@ -80,21 +187,96 @@ int xmit_protocol_message(struct cnx_info_t *info, char *message, int to_server)
  */
 char *generate_load_request();
 
+/**
+ * Formats an LREQ message for the given path (NULL: default) into buf (of
+ * size bytes) and returns its length
+ */
+int render_load_request(char *path, char *buf, int size);
+
 /**
  * Parses an LREQ request
  */
 int parse_load_request(char *message);
 
+/**
+ * Copies the path named in an LREQ, SUBS or HREQ message of len bytes to path (of
+ * size bytes), or an empty string if there is none. Returns 0 on success or
+ * -1 if the name does not fit.
+ */
+int parse_request_path(char *message, int len, char *path, int size);
+
 /**
  * Generates an LRSP message
  */
 char *generate_load_response(struct load_info_t *);
 
+/**
+ * Formats an LRSP message into buf (of size bytes) and returns its length.
+ * The path name is reported if not NULL.
+ */
+int render_load_response(struct load_info_t *linfo, char *path, char *buf, int size);
+
 /**
  * Parses an LRSP response message and returns load information
  */
 struct load_info_t *parse_load_response(char *message);
 
+/**
+ * Formats a SUBS message with the given filters (0: no filter) into buf (of
+ * size bytes) and returns its length
+ */
+int render_subscribe_request(double min_change, int min_interval, char *buf, int size);
+
+/**
+ * Parses the filters of a SUBS message of len bytes. Filters not present are
+ * set to 0. Returns 0 on success or -1 if the message is not valid.
+ */
+int parse_subscribe_request(char *message, int len, double *min_change, int *min_interval);
+
+/**
+ * Formats an HREQ message into buf (of size bytes) and returns its length.
+ * The path is left out if NULL.
+ */
+int render_history_request(char *path, long long from, long long to, int res, char *buf, int size);
+
+/**
+ * Parses the range and resolution of an HREQ message of len bytes (see
+ * HREQ_HDR). Returns 0 on success or -1 if the message is not valid.
+ */
+int parse_history_request(char *message, int len, long long *from, long long *to, int *res);
+
+/**
+ * Formats an HRSP message with n buckets into buf (of size bytes) and
+ * returns its length. The path name is reported if not NULL, and next if
+ * not 0.
+ */
+int render_history_response(int status, char *path, int res, struct history_bucket_t *buckets, int n, long long next,
+	char *buf, int size);
+
+/**
+ * Formats a binary LREQ message for a path index into buf (at least
+ * LBREQ_PATH_LEN bytes) and returns its length
+ */
+int render_load_request_bin(unsigned int path, char *buf);
+
+/**
+ * Returns the path index requested by a binary LREQ message of len bytes
+ * (0 if there is none, LB_ALLPATHS for all paths)
+ */
+unsigned int parse_load_request_bin(char *data, int len);
+
+/**
+ * Formats a binary LRSP message into buf (at least LBRSP_LEN bytes) and
+ * returns its length
+ */
+int render_load_response_bin(struct load_info_t *linfo, char *buf);
+
+/**
+ * Parses a binary LRSP message of len bytes into linfo. Returns 0 on
+ * success or -1 if the message is not valid.
+ */
+int parse_load_response_bin(char *data, int len, struct load_info_t *linfo);
+
 /*************************************/
 
 char *msg_to_lower_case(char *msg, int len);
@@ -21,9 +21,10 @@
 #include "ptpdevice.h"
 
 /**
- * Open the tty device to read delay values and configure it.
+ * Open the tty device to read delay values and configure it. The previous
+ * device attributes are saved to old_term.
  */
-int dev_init_comm(char *tty, int speed) {
+int dev_init_comm(char *tty, int speed, struct termios *old_term) {
 	int fid;
 	struct termios new_term;
 	
@@ -32,7 +33,7 @@ int dev_init_comm(char *tty, int speed) {
 		fprintf(stderr, "Error: Could not open %s\n", tty);
 		return -1;
 	}
-	else if (tcgetattr(fid, &old_term) < 0) {
+	else if (tcgetattr(fid, old_term) < 0) {
 		fprintf(stderr, "Error: Could not get attributes");
 		return -2;
 	}
@@ -42,10 +43,12 @@ int dev_init_comm(char *tty, int speed) {
 	}
 
 	fcntl(fid, F_SETFL, 0);
-	new_term = old_term;
-	//non-canonical mode
-	new_term.c_cflag |= ICANON;
+	new_term = *old_term;
+	//non-canonical mode, reads return up to a record at once
+	new_term.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
 	new_term.c_cflag |= CREAD;
+	new_term.c_cc[VMIN] = DEV_VMIN;
+	new_term.c_cc[VTIME] = DEV_VTIME;
 
 	//set terminal speed
 	cfsetspeed(&new_term, speed);
@@ -66,96 +69,201 @@ int dev_init_comm(char *tty, int speed) {
 }
 
 /**
- * Read a line of output from the ptp device (96bytes+crlf).
- * Returns the number of bytes read (including the trailing \n\n) and removes
- * \n\n from the end of the line.
+ * Close and reset serial dev to the attributes saved by dev_init_comm()
  */
-int dev_read_line(int fid, char *line, int len, int timeout) {
-	int bytes_read = 0;
-	int total = 0;
-	int remaining = len;
-	char data[len];
-	char *offset = line;
-	fd_set fds;
-	struct timeval tv;
+void dev_close(int fd, struct termios *old_term) {
+	if (fd > 0) {
+		tcsetattr(fd, TCSANOW, old_term);
+		close(fd);
+	}
+}
 
-	tv.tv_sec = timeout / 1000;
-	tv.tv_usec = (timeout % 1000) * 1000;
+/**
+ * Start reading records from fd. Data up to the first delimiter is discarded,
+ * since reading may start in the middle of a record.
+ */
+void dev_reader_init(struct dev_reader_t *r, int fd) {
+	r->fd = fd;
+	r->head = 0;
+	r->tail = 0;
+	r->scan = 0;
+	r->discard = 1;
+}
 
-	while (remaining > 0) {
-		memset(data, 0, len);
-		//check timeout
-		FD_ZERO(&fds);
-		FD_SET(fid, &fds);
-		select(fid + 1, &fds, NULL, NULL, &tv);
-
-		if (FD_ISSET(fid, &fds)) {
-			//try to read the remaining data
-			bytes_read = read(fid, offset, remaining);
-			remaining -= bytes_read;
-			offset += bytes_read;
-			total += bytes_read;
+/**
+ * Copy len bytes of the ring starting at position pos to line.
+ */
+static void dev_reader_copy(struct dev_reader_t *r, unsigned int pos, char *line, int len) {
+	int off = pos & (DEV_RINGLEN - 1);
+	int first = DEV_RINGLEN - off;
+
+	if (first > len) first = len;
+	memcpy(line, r->ring + off, first);
+	memcpy(line + first, r->ring, len - first);
+	line[len] = '\0';
+}
+
+/**
+ * Search the data read for the next record. Returns its length (and moves
+ * past it) or -1 if no full record has been read yet.
+ */
+static int dev_reader_split(struct dev_reader_t *r, char *line, int size) {
+	unsigned int start;
+	unsigned int pos;
+	int len;
+
+	while (r->scan != r->tail) {
+		pos = r->scan++;
+		if (pos == r->head || r->ring[pos & (DEV_RINGLEN - 1)] != DEV_DELIM
+			|| r->ring[(pos - 1) & (DEV_RINGLEN - 1)] != DEV_DELIM) {
+			continue;
+		}
+
+		start = r->head;
+		len = pos - 1 - start;
+		r->head = r->scan;
+		if (r->discard || len == 0) {
+			/* rest of a dropped record, or a blank line */
+			r->discard = 0;
+			continue;
 		}
-		else return total;
+
+		if (len > size - 1) len = size - 1;
+		dev_reader_copy(r, start, line, len);
+		return len;
 	}
 
-	//string ends with \n\n. Just fix it right...
-	if (line[total - 2] == '\n') line[total - 2] = '\0';
-	return total;
+	if (r->tail - r->head == DEV_RINGLEN) {
+		/* no delimiter in a full ring: hand out what we have and skip the
+		 * rest, keeping the last byte, which may start a delimiter */
+		len = r->discard ? -1 : size - 1;
+		if (len > 0) {
+			dev_reader_copy(r, r->head, line, len);
+			__atomic_store_n(&r->resyncs, r->resyncs + 1, __ATOMIC_RELAXED);
+		}
+		r->discard = 1;
+		r->head = r->tail - 1;
+		return len;
+	}
+	return -1;
 }
 
 /**
- * Close and reset serial dev
+ * Copy the next record, without the delimiter, to line (of size bytes) and
+ * return its length. Records longer than size - 1 bytes are truncated. Any
+ * number of bytes is read at a time, so records split across reads or several
+ * records in one read do not break synchronization. Returns DEV_TIMEOUT if no
+ * full record arrives within timeout msec, or DEV_ERROR if the device cannot
+ * be read.
  */
-void dev_close(int fd) {
-	if (fd > 0) {
-		tcsetattr(fd, TCSANOW, &old_term);
-		close(fd);
+int dev_reader_next(struct dev_reader_t *r, char *line, int size, int timeout) {
+	struct timeval tv;
+	fd_set fds;
+	int off;
+	int n;
+
+	tv.tv_sec = timeout / 1000;
+	tv.tv_usec = (timeout % 1000) * 1000;
+
+	while ((n = dev_reader_split(r, line, size)) < 0) {
+		/* select() leaves the time not slept in tv on Linux */
+		FD_ZERO(&fds);
+		FD_SET(r->fd, &fds);
+		n = select(r->fd + 1, &fds, NULL, NULL, &tv);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) return DEV_ERROR;
+		if (n == 0) return DEV_TIMEOUT;
+
+		/* fill the free space up to the end of the ring */
+		off = r->tail & (DEV_RINGLEN - 1);
+		n = DEV_RINGLEN - (r->tail - r->head);
+		if (n > DEV_RINGLEN - off) n = DEV_RINGLEN - off;
+		n = read(r->fd, r->ring + off, n);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return DEV_ERROR;
+		r->tail += n;
 	}
+	return n;
 }
 
+/* layout of the day/time prefix: d is a digit, other characters must match */
+static const char ptp_prefix[] = "ddd dd:dd:dd.ddd ";
+#define PTP_PREFIX_LEN		17
+#define PTP_TS_DIGITS		19
+
+static const char *ptp_reasons[PTP_NUM_REASONS] = {
+	"ok",
+	"bad line length",
+	"bad day/time field",
+	"bad timestamp",
+	"timestamp out of range"
+};
+
 /**
- * Resynchronize with serial device. We expect that each line is followed by
- * \n\n, so we read until we come across 2 consecutive \n chars. Normaly, it is 
- * run once on program start, but if exclusive access does not succeed on 
- * the serial device and some other process attempts to read from /dev/tty..., 
- * the program should try this function until it succeeds in reading a line
- * of the expected format.
+ * Read a 19-digit timestamp at p into ts. Returns PTP_LINE_OK or the reason
+ * it is invalid.
  */
-void dev_data_sync(int fd) {
-	//sync...consume data until you find \n\n
-	char c = 0;
-
-	do {
-		read(fd, &c, 1);
-		if (c == '\n') {
-			read(fd, &c, 1);
-			if (c == '\n') return;
+static inline int ptp_parse_timestamp(char *p, long long *ts) {
+	unsigned long long v = 0;
+	unsigned int d;
+	int i;
+
+	for (i = 0; i < PTP_TS_DIGITS; i++) {
+		d = (unsigned char)p[i] - '0';
+		if (d > 9) {
+			return p[i] ? PTP_ERR_TIMESTAMP : PTP_ERR_LENGTH;
 		}
-	} while(1);
+		v = 10 * v + d;
+	}
+	/* 19 digits never wrap around, but may exceed LLONG_MAX */
+	if (v > (unsigned long long)LLONG_MAX) return PTP_ERR_RANGE;
+	*ts = (long long)v;
+	return PTP_LINE_OK;
 }
 
 /**
- * Parse a line read from the ptp device and calculate the 1-way delay included
- * in the sample.
+ * Parse a line read from the ptp device in a single pass, validating the
+ * fixed SecureSync layout:
+ * DDD HH:MM:SS.mmm T1 T2 T3 T4
+ * where each timestamp has 19 digits. Returns PTP_LINE_OK or the reason the
+ * line was rejected, in which case sample is not modified.
  */
-long long extract_sample_delay(char *line) {
-	int x;
-	long long t1, t2, t3, t4;
-	sscanf(line, "%d %d:%d:%d.%d %Ld %Ld %Ld %Ld", &x, &x, &x, &x, &x, &t1, &t2, &t3, &t4);
-	return (t2 - t1 + t4 - t3)/2;
+int ptp_parse_line(char *line, struct ptp_sample_t *sample) {
+	long long ts[4];
+	char *p;
+	int ret;
+	int i;
+
+	for (i = 0; i < PTP_PREFIX_LEN; i++) {
+		if (!line[i]) return PTP_ERR_LENGTH;
+		if (ptp_prefix[i] == 'd' ? (unsigned int)((unsigned char)line[i] - '0') > 9 : line[i] != ptp_prefix[i]) {
+			return PTP_ERR_FORMAT;
+		}
+	}
+
+	p = line + PTP_PREFIX_LEN;
+	for (i = 0; i < 4; i++) {
+		ret = ptp_parse_timestamp(p, &ts[i]);
+		if (ret != PTP_LINE_OK) return ret;
+		p += PTP_TS_DIGITS;
+		if (i < 3) {
+			if (*p != ' ') return *p ? PTP_ERR_TIMESTAMP : PTP_ERR_LENGTH;
+			p++;
+		}
+	}
+	if (*p) return PTP_ERR_LENGTH;
+
+	sample->t1 = ts[0];
+	sample->t2 = ts[1];
+	sample->t3 = ts[2];
+	sample->t4 = ts[3];
+	return PTP_LINE_OK;
 }
 
 /**
- * If the T3 and T4 values are the same across two samples, then it's a SYNC.
+ * Return a description of a ptp_parse_line() result.
  */
-int is_sync(char *last_sample, char *sample) {
-	int x;
-	long long y, t3old, t4old, t3, t4, retval;
-	sscanf(last_sample, "%d %d:%d:%d.%d %Ld %Ld %Ld %Ld", &x, &x, &x, &x, &x, &y, &y, &t3old, &t4old);
-	sscanf(sample, "%d %d:%d:%d.%d %Ld %Ld %Ld %Ld", &x, &x, &x, &x, &x, &y, &y, &t3, &t4);
-
-	if (t3 == t3old && t4 == t4old) return 1;
-	return 0;
+const char *ptp_strerror(int reason) {
+	if (reason < 0 || reason >= PTP_NUM_REASONS) return "unknown";
+	return ptp_reasons[reason];
 }
-
@@ -29,46 +29,120 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <errno.h>
 
-struct termios old_term;
+/**
+ * Open the tty device to read delay values and configure it. The previous
+ * device attributes are saved to old_term.
+ */
+int dev_init_comm(char *tty, int speed, struct termios *old_term);
+
+/**
+ * Close and reset serial dev to the attributes saved by dev_init_comm()
+ */
+void dev_close(int fd, struct termios *old_term);
+
+/* records are followed by \n\n (the device sends \r\n, mapped by ICRNL) */
+#define DEV_DELIM			'\n'
+
+/* ring buffer size (power of 2) */
+#define DEV_RINGLEN			4096
+
+/* a read returns once a full record has arrived, or 100 msec after the last
+ * byte if less is available (termios VMIN/VTIME) */
+#define DEV_VMIN			(PTP_LINE_LEN + 2)
+#define DEV_VTIME			1
+
+/* dev_reader_next() results other than a record length */
+#define DEV_TIMEOUT			-1
+#define DEV_ERROR			-2
 
 /**
- * Open the tty device to read delay values and configure it.
+ * Buffered reader splitting the device output into records. Positions are
+ * free-running counters, taken modulo DEV_RINGLEN.
  */
-int dev_init_comm(char *tty, int speed);
+struct dev_reader_t {
+	int fd;
+	char ring[DEV_RINGLEN];
+	/* start of the current record */
+	unsigned int head;
+	/* end of the data read */
+	unsigned int tail;
+	/* next position to search for the delimiter */
+	unsigned int scan;
+	/* skipping the rest of a partial or oversized record */
+	int discard;
+	/* times the delimiter was lost and data skipped to find it again */
+	unsigned int resyncs;
+};
+
+/**
+ * Start reading records from fd. Data up to the first delimiter is discarded,
+ * since reading may start in the middle of a record.
+ */
+void dev_reader_init(struct dev_reader_t *r, int fd);
+
+/**
+ * Copy the next record, without the delimiter, to line (of size bytes) and
+ * return its length. Records longer than size - 1 bytes are truncated. Any
+ * number of bytes is read at a time, so records split across reads or several
+ * records in one read do not break synchronization. Returns DEV_TIMEOUT if no
+ * full record arrives within timeout msec, or DEV_ERROR if the device cannot
+ * be read.
+ */
+int dev_reader_next(struct dev_reader_t *r, char *line, int size, int timeout);
+
+/* length of a SecureSync line, without the trailing \n\n */
+#define PTP_LINE_LEN		96
+
+/* reasons for rejecting a line */
+#define PTP_LINE_OK			0
+#define PTP_ERR_LENGTH		1 /* not PTP_LINE_LEN characters */
+#define PTP_ERR_FORMAT		2 /* bad day/time field or separator */
+#define PTP_ERR_TIMESTAMP	3 /* timestamp not a 19-digit number */
+#define PTP_ERR_RANGE		4 /* timestamp does not fit in 64 bits */
+#define PTP_NUM_REASONS		5
 
 /**
- * Read a line of output from the ptp device (96bytes+crlf).
- * Returns the number of bytes read (including the trailing \n\n) and removes
- * \n\n from the end of the line.
+ * Timestamps (nsec) carried by a line: T1/T2 are the transmission/reception
+ * times of the SYNC message and T3/T4 those of the last DELAY_REQ.
  */
-int dev_read_line(int fid, char *line, int len, int timeout);
+struct ptp_sample_t {
+	long long t1;
+	long long t2;
+	long long t3;
+	long long t4;
+};
 
 /**
- * Close and reset serial dev
+ * Parse a line read from the ptp device in a single pass, validating the
+ * fixed SecureSync layout:
+ * DDD HH:MM:SS.mmm T1 T2 T3 T4
+ * where each timestamp has 19 digits. Returns PTP_LINE_OK or the reason the
+ * line was rejected, in which case sample is not modified.
  */
-void dev_close(int fd);
+int ptp_parse_line(char *line, struct ptp_sample_t *sample);
 
 /**
- * Resynchronize with serial device. We expect that each line is followed by
- * \n\n, so we read until we come across 2 consecutive \n chars. Normaly, it is 
- * run once on program start, but if exclusive access does not succeed on 
- * the serial device and some other process attempts to read from /dev/tty..., 
- * the program should try this function until it succeeds in reading a line
- * of the expected format.
+ * Return a description of a ptp_parse_line() result.
  */
-void dev_data_sync(int fd);
+const char *ptp_strerror(int reason);
 
 /**
- * Parse a line read from the ptp device and calculate the 1-way delay included
- * in the sample.
+ * Calculate the 1-way delay included in a sample.
  */
-long long extract_sample_delay(char *line);
+static inline long long ptp_sample_delay(struct ptp_sample_t *sample) {
+	return (sample->t2 - sample->t1 + sample->t4 - sample->t3) / 2;
+}
 
 /**
  * If the T3 and T4 values are the same across two samples, then it's a SYNC.
  */
-int is_sync(char *last_sample, char *sample);
+static inline int ptp_is_sync(struct ptp_sample_t *last, struct ptp_sample_t *sample) {
+	return sample->t3 == last->t3 && sample->t4 == last->t4;
+}
 
 #endif
 
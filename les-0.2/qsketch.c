@@ -0,0 +1,175 @@
+/**
+ * qsketch.c -- Constant memory streaming quantile estimation.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "qsketch.h"
+
+/**
+ * Bucket (0-based) a value is counted in.
+ */
+static int qsketch_bucket(long long value) {
+	int e;
+
+	if (value < QSKETCH_SUB) return value < 0 ? 0 : (int)value;
+	e = 63 - __builtin_clzll((unsigned long long)value);
+	if (e >= QSKETCH_MAXBITS) return QSKETCH_NBUCKETS - 1;
+	return (e - QSKETCH_SUBBITS + 1) * QSKETCH_SUB + (int)((value >> (e - QSKETCH_SUBBITS)) & (QSKETCH_SUB - 1));
+}
+
+/**
+ * Value reported for a bucket: the middle of its range.
+ */
+static long long qsketch_value(int bucket) {
+	int shift;
+
+	if (bucket < QSKETCH_SUB) return bucket;
+	shift = bucket / QSKETCH_SUB - 1;
+	return ((long long)(QSKETCH_SUB + bucket % QSKETCH_SUB) << shift) + ((1LL << shift) >> 1);
+}
+
+/**
+ * Clear a sketch.
+ */
+void qsketch_reset(struct qsketch_t *s) {
+	memset(s, 0, sizeof(struct qsketch_t));
+}
+
+/**
+ * Count a (non-negative) value.
+ */
+void qsketch_add(struct qsketch_t *s, long long value) {
+	int i;
+
+	if (!s->count || value < s->min) s->min = value;
+	if (!s->count || value > s->max) s->max = value;
+	for (i = qsketch_bucket(value) + 1; i <= QSKETCH_NBUCKETS; i += i & -i) {
+		s->tree[i]++;
+	}
+	s->count++;
+}
+
+/**
+ * Add the counts of src to dst.
+ */
+void qsketch_merge(struct qsketch_t *dst, struct qsketch_t *src) {
+	int i;
+
+	if (!src->count) return;
+	if (!dst->count || src->min < dst->min) dst->min = src->min;
+	if (!dst->count || src->max > dst->max) dst->max = src->max;
+	for (i = 1; i <= QSKETCH_NBUCKETS; i++) {
+		dst->tree[i] += src->tree[i];
+	}
+	dst->count += src->count;
+}
+
+/**
+ * Remove the counts of src, previously merged, from dst. The min and max of
+ * dst are left as they are.
+ */
+void qsketch_unmerge(struct qsketch_t *dst, struct qsketch_t *src) {
+	int i;
+
+	for (i = 1; i <= QSKETCH_NBUCKETS; i++) {
+		dst->tree[i] -= src->tree[i];
+	}
+	dst->count -= src->count;
+}
+
+/**
+ * Estimate the q-quantile (0 < q <= 1) of the values counted (the middle of
+ * its bucket, within the min and max counted), or return 0 if there are none.
+ */
+long long qsketch_quantile(struct qsketch_t *s, double q) {
+	unsigned int rank;
+	long long value;
+	int pos = 0;
+	int step;
+
+	if (!s->count) return 0;
+
+	/* the rank-th smallest value, 1-based */
+	rank = (unsigned int)(q * s->count + 0.999999);
+	if (rank < 1) rank = 1;
+	if (rank > s->count) rank = s->count;
+
+	/* find the last position with a prefix count below rank */
+	for (step = 1; step * 2 <= QSKETCH_NBUCKETS; step *= 2);
+	for (; step; step >>= 1) {
+		if (pos + step <= QSKETCH_NBUCKETS && s->tree[pos + step] < rank) {
+			pos += step;
+			rank -= s->tree[pos];
+		}
+	}
+	/* tree position pos + 1 is bucket pos */
+	value = qsketch_value(pos);
+	if (value < s->min) return s->min;
+	if (value > s->max) return s->max;
+	return value;
+}
+
+/**
+ * Clear a sliding horizon sketch and set its horizon (sec).
+ */
+void qwindow_init(struct qwindow_t *w, int horizon) {
+	memset(w, 0, sizeof(struct qwindow_t));
+	w->epoch_len = (long long)horizon * 1000000 / QWINDOW_EPOCHS;
+	if (w->epoch_len < 1) w->epoch_len = 1;
+}
+
+/**
+ * Count a value seen at time t (usec, not decreasing across calls).
+ */
+void qwindow_add(struct qwindow_t *w, long long t, long long value) {
+	long long epoch_len = w->epoch_len;
+	struct qsketch_t *e;
+	int found = 0;
+	int n, i;
+
+	if (!w->start) w->start = t;
+
+	if (t - w->start >= w->epoch_len) {
+		/* start a new epoch, dropping the oldest */
+		n = (t - w->start) / w->epoch_len;
+		if (n >= QWINDOW_EPOCHS) {
+			memset(w, 0, sizeof(struct qwindow_t));
+			w->epoch_len = epoch_len;
+			w->start = t;
+		}
+		else {
+			while (n--) {
+				w->cur = (w->cur + 1) % QWINDOW_EPOCHS;
+				qsketch_unmerge(&w->total, &w->epochs[w->cur]);
+				qsketch_reset(&w->epochs[w->cur]);
+				w->start += w->epoch_len;
+			}
+			/* min and max of the epochs left */
+			for (i = 0; i < QWINDOW_EPOCHS; i++) {
+				e = &w->epochs[i];
+				if (!e->count) continue;
+				if (!found || e->min < w->total.min) w->total.min = e->min;
+				if (!found || e->max > w->total.max) w->total.max = e->max;
+				found = 1;
+			}
+		}
+	}
+
+	qsketch_add(&w->epochs[w->cur], value);
+	qsketch_add(&w->total, value);
+}
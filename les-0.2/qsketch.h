@@ -0,0 +1,104 @@
+/**
+ * qsketch.h -- Constant memory streaming quantile estimation for delay
+ * samples. Values are counted in log-linear buckets (QSKETCH_SUB per power of
+ * two, i.e., a relative error of at most 1/QSKETCH_SUB) kept in a Fenwick
+ * tree, so that both adding a sample and looking up a quantile take
+ * O(log QSKETCH_NBUCKETS). Fenwick trees are linear in the bucket counts, so
+ * sketches merge (and unmerge) by adding (subtracting) their trees.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _QSKETCH_H_
+#define _QSKETCH_H_
+
+#include <string.h>
+
+#define QSKETCH_SUBBITS		5
+#define QSKETCH_SUB			(1 << QSKETCH_SUBBITS)
+/* values of 2^QSKETCH_MAXBITS or more are counted in the last bucket */
+#define QSKETCH_MAXBITS		40
+#define QSKETCH_NBUCKETS	((QSKETCH_MAXBITS - QSKETCH_SUBBITS + 1) * QSKETCH_SUB)
+
+/* number of epochs a sliding horizon is split into */
+#define QWINDOW_EPOCHS		8
+
+/**
+ * Quantile sketch. tree[1..QSKETCH_NBUCKETS] is the Fenwick tree of the
+ * bucket counts; min and max are the extreme values counted (if count > 0),
+ * which bound the quantiles reported.
+ */
+struct qsketch_t {
+	unsigned int tree[QSKETCH_NBUCKETS + 1];
+	unsigned int count;
+	long long min;
+	long long max;
+};
+
+/**
+ * Quantile sketch over a sliding time horizon: a sketch per epoch of
+ * horizon/QWINDOW_EPOCHS, and their merge. When an epoch starts, the oldest
+ * one is unmerged and reused, so the horizon covered varies between
+ * (QWINDOW_EPOCHS - 1)/QWINDOW_EPOCHS of the configured one and all of it.
+ */
+struct qwindow_t {
+	struct qsketch_t total;
+	struct qsketch_t epochs[QWINDOW_EPOCHS];
+	/* current epoch, its start and length (usec) */
+	int cur;
+	long long start;
+	long long epoch_len;
+};
+
+/**
+ * Clear a sketch.
+ */
+void qsketch_reset(struct qsketch_t *s);
+
+/**
+ * Count a (non-negative) value.
+ */
+void qsketch_add(struct qsketch_t *s, long long value);
+
+/**
+ * Add the counts of src to dst.
+ */
+void qsketch_merge(struct qsketch_t *dst, struct qsketch_t *src);
+
+/**
+ * Remove the counts of src, previously merged, from dst. The min and max of
+ * dst are left as they are.
+ */
+void qsketch_unmerge(struct qsketch_t *dst, struct qsketch_t *src);
+
+/**
+ * Estimate the q-quantile (0 < q <= 1) of the values counted (the middle of
+ * its bucket, within the min and max counted), or return 0 if there are none.
+ */
+long long qsketch_quantile(struct qsketch_t *s, double q);
+
+/**
+ * Clear a sliding horizon sketch and set its horizon (sec).
+ */
+void qwindow_init(struct qwindow_t *w, int horizon);
+
+/**
+ * Count a value seen at time t (usec, not decreasing across calls).
+ */
+void qwindow_add(struct qwindow_t *w, long long t, long long value);
+
+#endif
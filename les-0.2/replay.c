@@ -0,0 +1,90 @@
+/**
+ * replay.c -- Input of recorded SecureSync lines from a trace file.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "replay.h"
+
+/**
+ * Map a trace file. Returns 0 on success or -1 if it cannot be read.
+ */
+int replay_open(struct replay_t *r, char *fname) {
+	struct stat st;
+	int fd;
+
+	memset(r, 0, sizeof(struct replay_t));
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size == 0) {
+		close(fd);
+		return -1;
+	}
+	r->data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (r->data == MAP_FAILED) {
+		r->data = NULL;
+		return -1;
+	}
+	r->len = st.st_size;
+	madvise(r->data, r->len, MADV_SEQUENTIAL);
+	return 0;
+}
+
+/**
+ * Copy the next non-empty line (without \r\n, truncated to size - 1
+ * characters) to line and return its length, or -1 at the end of the trace.
+ */
+int replay_next(struct replay_t *r, char *line, int size) {
+	char *start;
+	char *eol;
+	int n;
+
+	while (r->pos < r->len) {
+		start = r->data + r->pos;
+		eol = memchr(start, '\n', r->len - r->pos);
+		n = eol ? eol - start : (int)(r->len - r->pos);
+		r->pos += n + 1;
+
+		if (n > 0 && start[n - 1] == '\r') n--;
+		if (!n) continue;
+		if (n >= size) n = size - 1;
+		memcpy(line, start, n);
+		line[n] = '\0';
+		return n;
+	}
+	return -1;
+}
+
+/**
+ * Start reading the trace from its first line again.
+ */
+void replay_rewind(struct replay_t *r) {
+	r->pos = 0;
+}
+
+/**
+ * Unmap a trace file.
+ */
+void replay_close(struct replay_t *r) {
+	if (r->data) {
+		munmap(r->data, r->len);
+		r->data = NULL;
+	}
+}
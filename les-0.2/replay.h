@@ -0,0 +1,67 @@
+/**
+ * replay.h -- Input of recorded SecureSync lines from a trace file, as an
+ * alternative to the PTP device (e.g., serialemu/data-long.log).
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* gaps in T2 longer than this (nsec) are not waited for when replaying at a
+ * given speed */
+#define REPLAY_MAXGAP	10000000000LL
+
+/**
+ * A memory mapped trace file, read line by line.
+ */
+struct replay_t {
+	char *data;
+	size_t len;
+	/* start of the next line */
+	size_t pos;
+};
+
+/**
+ * Map a trace file. Returns 0 on success or -1 if it cannot be read.
+ */
+int replay_open(struct replay_t *r, char *fname);
+
+/**
+ * Copy the next non-empty line (without \r\n, truncated to size - 1
+ * characters) to line and return its length, or -1 at the end of the trace.
+ */
+int replay_next(struct replay_t *r, char *line, int size);
+
+/**
+ * Start reading the trace from its first line again.
+ */
+void replay_rewind(struct replay_t *r);
+
+/**
+ * Unmap a trace file.
+ */
+void replay_close(struct replay_t *r);
+
+#endif
@@ -0,0 +1,444 @@
+/**
+ * samplelog.c -- Sample output file (and optional binary archive) written by
+ * a background thread, with rotation.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include "samplelog.h"
+
+extern char **environ;
+
+/**
+ * Milliseconds on the monotonic clock.
+ */
+static long long samplelog_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Append a sample to the output buffer, with a local timestamp. The date and
+ * time are formatted once per second.
+ */
+static void samplelog_format(struct samplelog_t *log, struct samplelog_rec_t *rec) {
+	struct tm ptm;
+
+	if (rec->tv.tv_sec != log->cached_sec || !log->cached_len) {
+		localtime_r(&rec->tv.tv_sec, &ptm);
+		log->cached_len = strftime(log->cached_ts, sizeof(log->cached_ts), "%Y-%m-%d,%H:%M:%S", &ptm);
+		log->cached_sec = rec->tv.tv_sec;
+	}
+
+	memcpy(log->buf + log->buflen, log->cached_ts, log->cached_len);
+	log->buflen += log->cached_len;
+	log->buflen += snprintf(log->buf + log->buflen, SAMPLELOG_RECLEN, ".%03ld\t%Ld\t%f\n",
+		(long)rec->tv.tv_usec / 1000, rec->sample, rec->load);
+}
+
+/**
+ * Write len bytes of buf out to fd.
+ */
+static void samplelog_write(int fd, char *buf, int len) {
+	int n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n <= 0) break; /* nothing to do about it; drop the batch */
+		buf += n;
+		len -= n;
+	}
+}
+
+/**
+ * Write out the output buffers.
+ */
+static void samplelog_flush(struct samplelog_t *log) {
+	samplelog_write(log->fd, log->buf, log->buflen);
+	log->written += log->buflen;
+	log->buflen = 0;
+	if (log->arcfd >= 0) {
+		samplelog_write(log->arcfd, (char*)log->arcbuf, log->arclen * sizeof(struct archive_rec_t));
+		log->arclen = 0;
+	}
+}
+
+/**
+ * Move queued samples to the output buffers, writing them out whenever they
+ * fill up. Returns the number of samples moved.
+ */
+static int samplelog_drain(struct samplelog_t *log) {
+	unsigned int tail = __atomic_load_n(&log->tail, __ATOMIC_ACQUIRE);
+	unsigned int head = log->head;
+	struct samplelog_rec_t *rec;
+	int n = 0;
+
+	for (; head != tail; head++, n++) {
+		rec = &log->queue[head & (SAMPLELOG_QLEN - 1)];
+		if (log->buflen + 32 + SAMPLELOG_RECLEN > SAMPLELOG_BUFLEN || log->arclen == SAMPLELOG_BUFLEN / sizeof(struct archive_rec_t)) {
+			samplelog_flush(log);
+		}
+		if (!(rec->flags & ARCHIVE_IGNORED)) {
+			samplelog_format(log, rec);
+		}
+		if (log->arcfd >= 0) {
+			archive_fill(&log->arcbuf[log->arclen++], &rec->tv, &rec->raw, rec->sample, rec->load, rec->flags);
+		}
+	}
+	__atomic_store_n(&log->head, head, __ATOMIC_RELEASE);
+	return n;
+}
+
+/**
+ * Seconds on the monotonic clock.
+ */
+static long long samplelog_seconds() {
+	return samplelog_now() / 1000;
+}
+
+/**
+ * Compress a rotated segment with SAMPLELOG_COMPRESS, at the lowest CPU
+ * priority (through nice, as posix_spawnp() cannot set it). Waits for the
+ * command to finish.
+ */
+static void samplelog_compress(char *segment) {
+	char *argv[] = {"nice", "-n", "19", SAMPLELOG_COMPRESS, "-f", "-q", segment, NULL};
+	pid_t pid;
+
+	/* unlike fork() and execlp(), safe in a multithreaded process */
+	if (!posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ)) {
+		waitpid(pid, NULL, 0);
+	}
+}
+
+static int samplelog_strcmp(const void *a, const void *b) {
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+/**
+ * Remove the oldest rotated segments (compressed or not) of the output file
+ * but the last conf.keep ones. Segments are named fname.YYYYmmdd-HHMMSS, so
+ * they sort by age.
+ */
+static void samplelog_prune(struct samplelog_t *log) {
+	char dirbuf[256];
+	char basebuf[256];
+	char path[600];
+	char *dir, *base;
+	char **names = NULL;
+	int nnames = 0;
+	int size = 0;
+	int baselen;
+	struct dirent *de;
+	DIR *d;
+	int i;
+
+	strcpy(dirbuf, log->fname);
+	strcpy(basebuf, log->fname);
+	dir = dirname(dirbuf);
+	base = basename(basebuf);
+	baselen = strlen(base);
+
+	d = opendir(dir);
+	if (!d) return;
+	while ((de = readdir(d))) {
+		if (strncmp(de->d_name, base, baselen) || de->d_name[baselen] != '.'
+			|| (unsigned int)(de->d_name[baselen + 1] - '0') > 9) {
+			continue;
+		}
+		if (nnames == size) {
+			size = size ? 2 * size : 16;
+			names = (char**)realloc(names, size * sizeof(char*));
+		}
+		names[nnames++] = strdup(de->d_name);
+	}
+	closedir(d);
+
+	if (!nnames) return;
+	qsort(names, nnames, sizeof(char*), samplelog_strcmp);
+	for (i = 0; i < nnames; i++) {
+		if (i < nnames - log->conf.keep) {
+			snprintf(path, sizeof(path), "%s/%s", dir, names[i]);
+			unlink(path);
+		}
+		free(names[i]);
+	}
+	free(names);
+}
+
+/**
+ * Housekeeping thread: compresses rotated segments and prunes old ones.
+ */
+static void *samplelog_housekeep(void *arg) {
+	struct samplelog_t *log = (struct samplelog_t*)arg;
+	char segment[272];
+
+	pthread_mutex_lock(&log->hk_mtx);
+	while (1) {
+		while (log->hk_running && !log->hk_npending) {
+			pthread_cond_wait(&log->hk_cond, &log->hk_mtx);
+		}
+		if (!log->hk_running) break;
+
+		strcpy(segment, log->hk_pending[0]);
+		log->hk_npending--;
+		memmove(log->hk_pending[0], log->hk_pending[1], log->hk_npending * sizeof(log->hk_pending[0]));
+		pthread_mutex_unlock(&log->hk_mtx);
+
+		if (log->conf.compress) {
+			samplelog_compress(segment);
+		}
+		samplelog_prune(log);
+
+		pthread_mutex_lock(&log->hk_mtx);
+	}
+	pthread_mutex_unlock(&log->hk_mtx);
+	return NULL;
+}
+
+/**
+ * Open the output file for appending (-1 if it cannot be opened).
+ */
+static void samplelog_open_output(struct samplelog_t *log) {
+	struct stat st;
+
+	log->fd = open(log->fname, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	log->written = (log->fd >= 0 && !fstat(log->fd, &st)) ? st.st_size : 0;
+	log->opened = samplelog_seconds();
+}
+
+/**
+ * Move the output file aside as fname.YYYYmmdd-HHMMSS, start a new one and
+ * hand the segment over to the housekeeping thread.
+ */
+static void samplelog_rotate(struct samplelog_t *log) {
+	char segment[272];
+	struct stat st;
+	struct tm ptm;
+	time_t now = time(NULL);
+	int len;
+	int fd;
+	int i;
+
+	localtime_r(&now, &ptm);
+	len = snprintf(segment, sizeof(segment), "%s.", log->fname);
+	strftime(segment + len, sizeof(segment) - len, "%Y%m%d-%H%M%S", &ptm);
+	len = strlen(segment);
+	for (i = 1; !stat(segment, &st); i++) {
+		snprintf(segment + len, sizeof(segment) - len, "-%d", i);
+	}
+
+	log->written = 0;
+	log->opened = samplelog_seconds();
+	if (log->fd < 0) {
+		/* not reopened after a failure; try again */
+		samplelog_open_output(log);
+		return;
+	}
+	if (rename(log->fname, segment) < 0) {
+		return; /* keep writing to the current file */
+	}
+	fd = open(log->fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		/* keep writing to the current file, under its name if it can be
+		 * moved back, and try again at the next rotation */
+		rename(segment, log->fname);
+		return;
+	}
+	close(log->fd);
+	log->fd = fd;
+
+	pthread_mutex_lock(&log->hk_mtx);
+	if (log->hk_npending < SAMPLELOG_MAXPENDING) {
+		strcpy(log->hk_pending[log->hk_npending++], segment);
+		pthread_cond_signal(&log->hk_cond);
+	}
+	pthread_mutex_unlock(&log->hk_mtx);
+}
+
+/**
+ * Reopen the output file and archive for appending.
+ */
+static void samplelog_do_reopen(struct samplelog_t *log) {
+	if (log->fd >= 0) close(log->fd);
+	samplelog_open_output(log);
+
+	if (log->arcfd >= 0) {
+		close(log->arcfd);
+		log->arcfd = archive_open(log->arcname);
+	}
+}
+
+/**
+ * Writer thread.
+ */
+static void *samplelog_run(void *arg) {
+	struct samplelog_t *log = (struct samplelog_t*)arg;
+	struct samplelog_conf_t *conf = &log->conf;
+	/* a lossless log is drained more often, as its producer waits for it */
+	struct timespec poll = {0, (conf->lossless ? 1 : SAMPLELOG_POLL) * 1000000L};
+	long long last_flush = samplelog_now();
+	long long now;
+	int n = 0;
+
+	while (__atomic_load_n(&log->running, __ATOMIC_ACQUIRE)) {
+		/* keep draining without sleeping while samples arrive in bursts */
+		if (n < SAMPLELOG_QLEN / 4) {
+			nanosleep(&poll, NULL);
+		}
+		n = samplelog_drain(log);
+
+		now = samplelog_now();
+		if (log->buflen + log->arclen * (int)sizeof(struct archive_rec_t) >= conf->flush_bytes
+			|| ((log->buflen || log->arclen) && now - last_flush >= conf->flush_interval)) {
+			samplelog_flush(log);
+			last_flush = now;
+		}
+
+		if (__atomic_exchange_n(&log->reopen, 0, __ATOMIC_ACQUIRE)) {
+			samplelog_flush(log);
+			samplelog_do_reopen(log);
+		}
+		if ((conf->rotate_size && log->written >= conf->rotate_size)
+			|| (conf->rotate_interval && now / 1000 - log->opened >= conf->rotate_interval)) {
+			samplelog_flush(log);
+			samplelog_rotate(log);
+		}
+		else if (log->fd < 0 && now / 1000 - log->opened >= SAMPLELOG_RETRY) {
+			/* the output file could not be reopened */
+			samplelog_open_output(log);
+		}
+	}
+
+	samplelog_drain(log);
+	samplelog_flush(log);
+	return NULL;
+}
+
+/**
+ * Open (truncate) the output file, and the archive for appending if set, and
+ * start the writer thread, as well as the housekeeping thread if the output
+ * file is rotated. Returns 0 on success, -1 if the output file or -2 if the
+ * archive cannot be opened.
+ */
+int samplelog_open(struct samplelog_t *log, struct samplelog_conf_t *conf) {
+	memset(log, 0, sizeof(struct samplelog_t));
+	log->conf = *conf;
+	log->arcfd = -1;
+	strncpy(log->fname, conf->fname, sizeof(log->fname) - 1);
+	log->conf.fname = log->fname;
+	if (conf->arcname) {
+		strncpy(log->arcname, conf->arcname, sizeof(log->arcname) - 1);
+	}
+	log->conf.arcname = log->arcname;
+
+	log->fd = open(log->fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (log->fd < 0) {
+		return -1;
+	}
+	if (*log->arcname) {
+		log->arcfd = archive_open(log->arcname);
+		if (log->arcfd < 0) {
+			close(log->fd);
+			log->fd = -1;
+			return -2;
+		}
+	}
+	log->opened = samplelog_seconds();
+
+	pthread_mutex_init(&log->hk_mtx, NULL);
+	pthread_cond_init(&log->hk_cond, NULL);
+	if (conf->rotate_size || conf->rotate_interval) {
+		log->hk_running = 1;
+		if (pthread_create(&log->hk_thread, NULL, samplelog_housekeep, log)) {
+			log->hk_running = 0;
+		}
+	}
+
+	log->running = 1;
+	if (pthread_create(&log->thread, NULL, samplelog_run, log)) {
+		log->running = 0;
+		samplelog_close(log);
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Have the writer reopen the output file and archive (appending to them),
+ * e.g., after they have been moved away. Async-signal-safe.
+ */
+void samplelog_reopen(struct samplelog_t *log) {
+	__atomic_store_n(&log->reopen, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Queue a delay sample computed from the raw timestamps and the current load
+ * estimate, timestamped now. Called by a single thread; never blocks unless
+ * the log is lossless. Returns -1 if the sample was dropped.
+ */
+int samplelog_push(struct samplelog_t *log, struct ptp_sample_t *raw, long long sample, double load, int flags) {
+	struct timespec wait = {0, 100000};
+	struct samplelog_rec_t *rec;
+	unsigned int tail = log->tail;
+
+	if (!log->running) {
+		return -1;
+	}
+	if ((flags & ARCHIVE_IGNORED) && log->arcfd < 0) {
+		return 0;
+	}
+	while (tail - __atomic_load_n(&log->head, __ATOMIC_ACQUIRE) == SAMPLELOG_QLEN) {
+		if (!log->conf.lossless) {
+			log->dropped++;
+			return -1;
+		}
+		nanosleep(&wait, NULL);
+	}
+
+	rec = &log->queue[tail & (SAMPLELOG_QLEN - 1)];
+	gettimeofday(&rec->tv, NULL);
+	rec->raw = *raw;
+	rec->sample = sample;
+	rec->load = load;
+	rec->flags = flags;
+	__atomic_store_n(&log->tail, tail + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * Stop the writer thread after it writes out all queued samples, and close
+ * the files. Segments not compressed yet are left as they are.
+ */
+void samplelog_close(struct samplelog_t *log) {
+	if (__atomic_load_n(&log->running, __ATOMIC_ACQUIRE)) {
+		__atomic_store_n(&log->running, 0, __ATOMIC_RELEASE);
+		pthread_join(log->thread, NULL);
+	}
+	if (log->hk_running) {
+		pthread_mutex_lock(&log->hk_mtx);
+		log->hk_running = 0;
+		pthread_cond_signal(&log->hk_cond);
+		pthread_mutex_unlock(&log->hk_mtx);
+		pthread_join(log->hk_thread, NULL);
+	}
+	if (log->fd >= 0) close(log->fd);
+	log->fd = -1;
+	if (log->arcfd >= 0) close(log->arcfd);
+	log->arcfd = -1;
+}
@@ -0,0 +1,170 @@
+/**
+ * samplelog.h -- Sample output file (and optional binary archive) written by
+ * a background thread. The device thread queues delay samples on a
+ * single-producer/single-consumer ring and never touches the filesystem; the
+ * writer formats them in batches and writes them out on an interval or once
+ * enough bytes are pending. The output file may be rotated by size or age;
+ * rotated segments are compressed and pruned by another, low priority,
+ * thread.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SAMPLELOG_H_
+#define _SAMPLELOG_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <dirent.h>
+#include <libgen.h>
+
+#include "archive.h"
+
+/* queued samples (power of 2); samples are dropped if the writer lags more */
+#define SAMPLELOG_QLEN		1024
+
+/* output buffer; a batch is written out at the latest when it is full */
+#define SAMPLELOG_BUFLEN	65536
+
+/* max length of a formatted sample */
+#define SAMPLELOG_RECLEN	80
+
+/* how often the writer drains the queue (msec) */
+#define SAMPLELOG_POLL		50
+
+/* how often opening the output file is retried after it failed (sec) */
+#define SAMPLELOG_RETRY		1
+
+/* rotated segments waiting to be compressed */
+#define SAMPLELOG_MAXPENDING	8
+
+/* compression command, run on each rotated segment */
+#define SAMPLELOG_COMPRESS	"gzip"
+
+/**
+ * Output configuration.
+ */
+struct samplelog_conf_t {
+	/* sample output file */
+	char *fname;
+	/* archive (NULL or empty: none) */
+	char *arcname;
+	/* write out after this many msec (0: every poll) or pending bytes */
+	int flush_interval;
+	int flush_bytes;
+	/* rotate after this many bytes or seconds (0: never) */
+	long long rotate_size;
+	int rotate_interval;
+	/* rotated segments kept */
+	int keep;
+	/* compress rotated segments */
+	int compress;
+	/* wait for room in the queue instead of dropping samples (replay) */
+	int lossless;
+};
+
+/**
+ * A delay sample, as queued by the device thread.
+ */
+struct samplelog_rec_t {
+	struct timeval tv;
+	struct ptp_sample_t raw;
+	long long sample;
+	double load;
+	/* ARCHIVE_* flags; ignored samples are archived only */
+	int flags;
+};
+
+struct samplelog_t {
+	struct samplelog_conf_t conf;
+	char fname[256];
+	char arcname[256];
+	/* output file (-1: could not be reopened, samples are dropped meanwhile) */
+	int fd;
+	/* archive (-1: none) */
+	int arcfd;
+	/* bytes written to and time (sec) of opening the current file */
+	long long written;
+	long long opened;
+	/* set to reopen the files (e.g., after external rotation) */
+	int reopen;
+
+	/* queue: head is advanced by the writer, tail by the device thread */
+	struct samplelog_rec_t queue[SAMPLELOG_QLEN];
+	unsigned int head;
+	unsigned int tail;
+	/* samples dropped because the queue was full */
+	unsigned int dropped;
+
+	/* writer state */
+	pthread_t thread;
+	int running;
+	char buf[SAMPLELOG_BUFLEN];
+	int buflen;
+	struct archive_rec_t arcbuf[SAMPLELOG_BUFLEN / sizeof(struct archive_rec_t)];
+	int arclen;
+	/* formatted date and time of the second of the last sample */
+	time_t cached_sec;
+	char cached_ts[32];
+	int cached_len;
+
+	/* rotated segments to compress, handled by the housekeeping thread */
+	pthread_t hk_thread;
+	pthread_mutex_t hk_mtx;
+	pthread_cond_t hk_cond;
+	char hk_pending[SAMPLELOG_MAXPENDING][272];
+	int hk_npending;
+	int hk_running;
+};
+
+/**
+ * Open (truncate) the output file, and the archive for appending if set, and
+ * start the writer thread, as well as the housekeeping thread if the output
+ * file is rotated. Returns 0 on success, -1 if the output file or -2 if the
+ * archive cannot be opened.
+ */
+int samplelog_open(struct samplelog_t *log, struct samplelog_conf_t *conf);
+
+/**
+ * Have the writer reopen the output file and archive (appending to them),
+ * e.g., after they have been moved away. Async-signal-safe.
+ */
+void samplelog_reopen(struct samplelog_t *log);
+
+/**
+ * Queue a delay sample computed from the raw timestamps and the current load
+ * estimate, timestamped now. Called by a single thread; never blocks unless
+ * the log is lossless. Returns -1 if the sample was dropped.
+ */
+int samplelog_push(struct samplelog_t *log, struct ptp_sample_t *raw, long long sample, double load, int flags);
+
+/**
+ * Stop the writer thread after it writes out all queued samples, and close
+ * the files. Segments not compressed yet are left as they are.
+ */
+void samplelog_close(struct samplelog_t *log);
+
+#endif
@@ -0,0 +1,71 @@
+/**
+ * seqlock.h -- Sequence lock for publishing data written by a single thread
+ * to any number of readers. Readers never block the writer: they copy the
+ * data and retry if a write happened meanwhile.
+ *
+ * Copyright (C) 2012-2013 Pantelis A. Frangoudis <pfrag@aueb.gr>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef _SEQLOCK_H_
+#define _SEQLOCK_H_
+
+#include <sched.h>
+
+/**
+ * The sequence number is odd while a write is in progress.
+ */
+struct seqlock_t {
+	unsigned int seq;
+};
+
+/**
+ * Start a read section. Returns the sequence number to pass to
+ * seqlock_read_retry().
+ */
+static inline unsigned int seqlock_read_begin(struct seqlock_t *sl) {
+	unsigned int seq;
+	while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1) {
+		sched_yield();
+	}
+	return seq;
+}
+
+/**
+ * End a read section. Returns 1 if the data read may be inconsistent and
+ * the read must be repeated.
+ */
+static inline int seqlock_read_retry(struct seqlock_t *sl, unsigned int seq) {
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+/**
+ * Start a write section (single writer).
+ */
+static inline void seqlock_write_begin(struct seqlock_t *sl) {
+	__atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * End a write section.
+ */
+static inline void seqlock_write_end(struct seqlock_t *sl) {
+	__atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -21,49 +21,53 @@
 #include "window.h"
 
 /**
- * Add a new sample and slide the window.
+ * Allocate a window of the given size.
  */
-void window_slide(struct window_t **win, double sample, int size) {
-	int i = 0;
-
-	struct window_t *cur = *win;
-	struct window_t *last = NULL;
-	struct window_t *prev = NULL;
-
-	while (cur) {
-		i++;
-		if (i > 1) {
-			prev = last;
-		}
-		last = cur;
-		cur = cur->next;
-	}
+int window_init(struct window_t *win, int size) {
+	memset(win, 0, sizeof(struct window_t));
+	if (size < 1) size = 1;
 
-	/* if window is full, remove last item */
-	if (i == size) {
-		/* pop last */
-		if (prev) {
-			prev->next = NULL;
-		}
-		if (*win == last) {
-			*win = NULL;
-		}
-		free(last);
+	win->samples = (double*)malloc(size * sizeof(double));
+	if (!win->samples) {
+		return -1;
 	}
+	memset(win->samples, 0, size * sizeof(double));
+	win->size = size;
+	return 0;
+}
 
-	/* alloc space for new window sample */
-	struct window_t *newsample = (struct window_t*)malloc(sizeof(struct window_t));
-	memset(newsample, 0, sizeof(struct window_t));
-	newsample->sample = sample;
-	newsample->next = NULL;
+/**
+ * Add a new sample and slide the window.
+ */
+void window_slide(struct window_t *win, double sample) {
+	double old;
+	int i;
 
-	/* add sample */
-	if (*win) {
-		newsample->next = *win;
-		*win = newsample;
+	if (win->count == win->size) {
+		/* window is full, the oldest sample is overwritten */
+		old = win->samples[win->head];
+		win->sum -= old;
+		win->sumsq -= old * old;
 	}
 	else {
-		*win = newsample;
+		win->count++;
+	}
+
+	win->samples[win->head] = sample;
+	win->sum += sample;
+	win->sumsq += sample * sample;
+
+	win->head++;
+	if (win->head == win->size) {
+		win->head = 0;
+
+		/* once per round, recompute sums to drop accumulated rounding errors */
+		win->sum = 0.0;
+		win->sumsq = 0.0;
+		for (i = 0; i < win->count; i++) {
+			win->sum += win->samples[i];
+			win->sumsq += win->samples[i] * win->samples[i];
+		}
 	}
 }
 
@@ -71,40 +75,66 @@ void window_slide(struct window_t **win, double sample, int size) {
  * Calculate window average.
  */
 double window_average(struct window_t *win) {
-	double sum = 0.0;
-	int samples = 0;
-	struct window_t *cur = win;
-	while (cur) {
-		sum += cur->sample;
-		samples++;
-		cur = cur->next;
-	}
+	return (win->sum/(double)win->count);
+}
+
+/**
+ * Calculate window (population) variance.
+ */
+double window_variance(struct window_t *win) {
+	double avg;
+	double var;
+
+	if (!win->count) return 0.0;
 
-	return (sum/(double)samples);
+	avg = win->sum / (double)win->count;
+	var = win->sumsq / (double)win->count - avg * avg;
+	return (var > 0.0 ? var : 0.0);
 }
 
 /**
- * Print window samples.
+ * Print window samples, newest first.
  */
 void window_print(struct window_t *win) {
-	struct window_t *cur = win;
-	while(cur) {
-		printf("%f\t", cur->sample);
-		cur = cur->next;
+	int i;
+	int pos = win->head;
+	for (i = 0; i < win->count; i++) {
+		pos = (pos == 0 ? win->size : pos) - 1;
+		printf("%f\t", win->samples[pos]);
 	}
 	printf("\n");
 }
 
 /**
- * Free window memory.
+ * Change the window size, keeping the most recent samples that fit. Returns
+ * 0 on success or -1 (window unchanged) if memory cannot be allocated.
  */
-void window_free(struct window_t *win) {
-	struct window_t *cur = win;
-	struct window_t *toremove = NULL;
-	while (cur) {
-		toremove = cur;
-		cur = cur->next;
-		free(toremove);
+int window_resize(struct window_t *win, int size) {
+	struct window_t resized;
+	int pos;
+	int n;
+
+	if (window_init(&resized, size) < 0) {
+		return -1;
+	}
+	/* replay the kept samples, oldest first */
+	n = win->count < resized.size ? win->count : resized.size;
+	pos = (win->head - n + win->size) % win->size;
+	while (n--) {
+		window_slide(&resized, win->samples[pos]);
+		pos = (pos + 1) % win->size;
 	}
+	window_free(win);
+	*win = resized;
+	return 0;
 }
 
+/**
+ * Free window memory.
+ */
+void window_free(struct window_t *win) {
+	if (win->samples) free(win->samples);
+	win->samples = NULL;
+	win->count = 0;
+	win->head = 0;
+}
@@ -26,32 +26,56 @@
 #include <stdlib.h>
 
 /**
- * Sample window structure.
+ * Sample window structure. Samples are kept in a preallocated ring and the
+ * sum and sum of squares are updated as samples enter and leave, so both
+ * sliding and statistics are O(1).
  */
 struct window_t {
-	double sample;
-	struct window_t* next;
+	double *samples;
+	/* window capacity */
+	int size;
+	/* number of samples currently in the window */
+	int count;
+	/* position of the next sample */
+	int head;
+	double sum;
+	double sumsq;
 };
 
+/**
+ * Allocate a window of the given size.
+ */
+int window_init(struct window_t *win, int size);
+
 /**
  * Add a new sample and slide the window.
  */
-void window_slide(struct window_t **win, double sample, int size);
+void window_slide(struct window_t *win, double sample);
 
 /**
  * Calculate window average.
  */
 double window_average(struct window_t *win);
 
+/**
+ * Calculate window (population) variance.
+ */
+double window_variance(struct window_t *win);
+
 /**
  * Print window samples.
  */
 void window_print(struct window_t *win);
 
+/**
+ * Change the window size, keeping the most recent samples that fit. Returns
+ * 0 on success or -1 (window unchanged) if memory cannot be allocated.
+ */
+int window_resize(struct window_t *win, int size);
+
 /**
  * Free window memory.
  */
 void window_free(struct window_t *win);
 
 #endif
-